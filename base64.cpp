@@ -0,0 +1,287 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+/*
+base64.cpp - Base64 encoding and decoding of raw property data.
+
+The standard alphabet with '=' padding (RFC 4648). Where the processor has
+AVX2, 24 bytes are encoded to 32 characters at a time and 32 characters
+decoded to 24 bytes, using the lookup schemes described by Wojciech Muła and
+Daniel Lemire in "Faster Base64 Encoding and Decoding using AVX2
+Instructions". Everything else, including the padded end, is handled one
+group of 3 bytes or 4 characters at a time.
+*/
+
+#include "xcom.h"
+#include "util.h"
+
+#include <array>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define XCOM_BASE64_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(XCOM_BASE64_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define XCOM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define XCOM_TARGET_AVX2
+#endif
+
+namespace xcom
+{
+    namespace util
+    {
+        static const char base64_digits[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        // The value of each character as a base64 digit, or -1.
+        static const std::array<int8_t, 256> base64_values = []() {
+            std::array<int8_t, 256> values;
+            values.fill(-1);
+            for (int i = 0; i < 64; ++i) {
+                values[static_cast<unsigned char>(base64_digits[i])] = static_cast<int8_t>(i);
+            }
+            return values;
+        }();
+
+        static void to_base64_scalar(const unsigned char *data, size_t length, char *out)
+        {
+            size_t i = 0;
+            for (; i + 3 <= length; i += 3, out += 4) {
+                uint32_t group = (data[i] << 16) | (data[i + 1] << 8) | data[i + 2];
+                out[0] = base64_digits[group >> 18];
+                out[1] = base64_digits[(group >> 12) & 0x3F];
+                out[2] = base64_digits[(group >> 6) & 0x3F];
+                out[3] = base64_digits[group & 0x3F];
+            }
+
+            if (i < length) {
+                uint32_t group = data[i] << 16;
+                if (i + 1 < length) {
+                    group |= data[i + 1] << 8;
+                }
+                out[0] = base64_digits[group >> 18];
+                out[1] = base64_digits[(group >> 12) & 0x3F];
+                out[2] = (i + 1 < length) ? base64_digits[(group >> 6) & 0x3F] : '=';
+                out[3] = '=';
+            }
+        }
+
+        static void bad_base64_character(const char *str, size_t offset)
+        {
+            std::string message = "unexpected base64 character '";
+            message.append(1, str[offset]);
+            message += "' at offset " + std::to_string(offset);
+            throw error::general_exception(message);
+        }
+
+        // Decode the characters from 'start' on. 'length' is the whole
+        // length of str, and 'padding' the number of '=' at its end.
+        static void from_base64_scalar(const char *str, size_t start, size_t length, size_t padding,
+            unsigned char *out)
+        {
+            for (size_t i = start; i < length; i += 4) {
+                bool last = (i + 4 == length);
+                uint32_t group = 0;
+                for (size_t j = 0; j < 4; ++j) {
+                    int value = base64_values[static_cast<unsigned char>(str[i + j])];
+                    if (value < 0) {
+                        if (!last || j < 4 - padding) {
+                            bad_base64_character(str, i + j);
+                        }
+                        value = 0;
+                    }
+                    group = (group << 6) | static_cast<uint32_t>(value);
+                }
+
+                size_t bytes = last ? 3 - padding : 3;
+                out[0] = static_cast<unsigned char>(group >> 16);
+                if (bytes > 1) {
+                    out[1] = static_cast<unsigned char>(group >> 8);
+                }
+                if (bytes > 2) {
+                    out[2] = static_cast<unsigned char>(group);
+                }
+                out += bytes;
+            }
+        }
+
+#ifdef XCOM_BASE64_SIMD
+        // Turn 6-bit values into base64 digits by adding the offset of their
+        // range of the alphabet.
+        XCOM_TARGET_AVX2 static inline __m256i values_to_base64_avx2(__m256i values)
+        {
+            const __m256i offsets = _mm256_setr_epi8(
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+            // 0-25 map to 13, 26-51 to 0, 52-61 to 1-10, 62 to 11, 63 to 12.
+            __m256i range = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+            __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), values);
+            range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+            return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), values);
+        }
+
+        // Encode blocks of 24 bytes. Each block is loaded as two overlapping
+        // 16-byte halves, so 8 bytes past it have to be readable.
+        XCOM_TARGET_AVX2 static size_t to_base64_avx2(const unsigned char *data, size_t length, char *out)
+        {
+            // Put the bytes of each group of three in the order b a c b
+            // within a 32-bit lane.
+            const __m256i spread = _mm256_setr_epi8(
+                1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+            size_t i = 0;
+            for (; i + 32 <= length; i += 24) {
+                __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 12));
+                __m256i bytes = _mm256_shuffle_epi8(
+                    _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1), spread);
+
+                // Move each 6-bit field into its own byte.
+                __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(bytes, _mm256_set1_epi32(0x0FC0FC00)),
+                    _mm256_set1_epi32(0x04000040));
+                __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(bytes, _mm256_set1_epi32(0x003F03F0)),
+                    _mm256_set1_epi32(0x01000010));
+                __m256i values = _mm256_or_si256(ac, bd);
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i / 3 * 4), values_to_base64_avx2(values));
+            }
+            return i;
+        }
+
+        // Decode blocks of 32 characters, stopping at the first block with
+        // anything but base64 digits in it (including padding) so the scalar
+        // code can deal with it.
+        XCOM_TARGET_AVX2 static size_t from_base64_avx2(const char *str, size_t length, unsigned char *out)
+        {
+            // A character is valid if the bits for its low and high nibbles
+            // have nothing in common.
+            const __m256i valid_low = _mm256_setr_epi8(
+                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+            const __m256i valid_high = _mm256_setr_epi8(
+                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+            // What to add to a character to get its value, by high nibble
+            // ('/' has its own entry).
+            const __m256i offsets = _mm256_setr_epi8(
+                0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+            const __m256i slash = _mm256_set1_epi8('/');
+            // Gather the three bytes decoded from each 32-bit lane.
+            const __m256i gather = _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+            const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+            const __m256i store_mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+
+            size_t i = 0;
+            for (; i + 32 <= length; i += 32) {
+                __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i));
+                __m256i high_nibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), slash);
+                __m256i low_nibbles = _mm256_and_si256(chars, slash);
+                __m256i low = _mm256_shuffle_epi8(valid_low, low_nibbles);
+                __m256i high = _mm256_shuffle_epi8(valid_high, high_nibbles);
+                if (!_mm256_testz_si256(low, high)) {
+                    break;
+                }
+
+                __m256i is_slash = _mm256_cmpeq_epi8(chars, slash);
+                __m256i values = _mm256_add_epi8(chars,
+                    _mm256_shuffle_epi8(offsets, _mm256_add_epi8(is_slash, high_nibbles)));
+
+                // Join pairs of 6-bit values, then pairs of 12-bit values.
+                __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+                __m256i groups = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+                __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(groups, gather), pack);
+                _mm256_maskstore_epi32(reinterpret_cast<int*>(out + i / 4 * 3), store_mask, bytes);
+            }
+            return i;
+        }
+#endif
+
+        size_t base64_size(size_t length)
+        {
+            return (length + 2) / 3 * 4;
+        }
+
+        void to_base64(const unsigned char *data, size_t length, char *out)
+        {
+            size_t done = 0;
+#ifdef XCOM_BASE64_SIMD
+            if (have_avx2()) {
+                done = to_base64_avx2(data, length, out);
+            }
+#endif
+            to_base64_scalar(data + done, length - done, out + done / 3 * 4);
+        }
+
+        std::string to_base64(const unsigned char *data, size_t length)
+        {
+            std::string str(base64_size(length), '\0');
+            to_base64(data, length, &str[0]);
+            return str;
+        }
+
+        // The number of '=' at the end of some base64 text.
+        static size_t base64_padding(const char *str, size_t length)
+        {
+            if (length % 4 != 0) {
+                throw error::general_exception("base64 data has a length that isn't a multiple of 4: " +
+                    std::to_string(length));
+            }
+            size_t padding = 0;
+            while (padding < 2 && padding < length && str[length - 1 - padding] == '=') {
+                ++padding;
+            }
+            return padding;
+        }
+
+        size_t from_base64_size(const char *str, size_t length)
+        {
+            return length / 4 * 3 - base64_padding(str, length);
+        }
+
+        void from_base64(const char *str, size_t length, unsigned char *out)
+        {
+            size_t padding = base64_padding(str, length);
+            size_t done = 0;
+#ifdef XCOM_BASE64_SIMD
+            if (have_avx2()) {
+                done = from_base64_avx2(str, length, out);
+            }
+#endif
+            from_base64_scalar(str, done, length, padding, out + done / 4 * 3);
+        }
+
+        std::unique_ptr<unsigned char[]> from_base64(const std::string& str, size_t& length)
+        {
+            length = from_base64_size(str.data(), str.length());
+            std::unique_ptr<unsigned char[]> data = std::make_unique<unsigned char[]>(length);
+            from_base64(str.data(), str.length(), data.get());
+            return data;
+        }
+    }
+}
@@ -0,0 +1,152 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "batch.h"
+#include "xcom.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if __has_include(<filesystem>)
+#include <filesystem>
+namespace fs = std::filesystem;
+#elif __has_include(<experimental/filesystem>)
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#else
+#error No <filesystem> support on this platform.
+#endif
+
+namespace xcom
+{
+    static void expand_one(const std::string& arg, const std::function<bool(const std::string&)>& accept,
+        std::vector<std::string>& files)
+    {
+        if (arg.size() > 1 && arg[0] == '@') {
+            std::ifstream list{ arg.substr(1) };
+            if (!list) {
+                throw error::general_exception("error opening list file " + arg.substr(1));
+            }
+
+            std::string line;
+            while (std::getline(list, line)) {
+                // Tolerate lists written on Windows.
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!line.empty()) {
+                    expand_one(line, accept, files);
+                }
+            }
+            return;
+        }
+
+        std::error_code ec;
+        if (fs::is_directory(arg, ec)) {
+            std::vector<std::string> dir_files;
+            for (const auto& entry : fs::directory_iterator(arg)) {
+                std::string name = entry.path().string();
+                if (fs::is_regular_file(entry.status()) && accept(name)) {
+                    dir_files.push_back(name);
+                }
+            }
+
+            // Directory order is unspecified; sort so runs are repeatable.
+            std::sort(dir_files.begin(), dir_files.end());
+            files.insert(files.end(), dir_files.begin(), dir_files.end());
+            return;
+        }
+
+        files.push_back(arg);
+    }
+
+    std::vector<std::string> expand_batch_inputs(const std::vector<std::string>& args,
+        const std::function<bool(const std::string&)>& accept)
+    {
+        std::vector<std::string> files;
+        for (const std::string& arg : args) {
+            expand_one(arg, accept, files);
+        }
+        return files;
+    }
+
+    void check_batch_outputs(const std::vector<batch_job>& jobs)
+    {
+        std::unordered_map<std::string, const batch_job*> by_output;
+        for (const batch_job& job : jobs) {
+            auto inserted = by_output.emplace(job.outfile, &job);
+            if (!inserted.second) {
+                throw error::general_exception(inserted.first->second->infile + " and " + job.infile +
+                    " would both be written to " + job.outfile);
+            }
+        }
+    }
+
+    size_t run_batch(const std::vector<batch_job>& jobs, unsigned threads,
+        const std::function<void(const batch_job&)>& convert)
+    {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threads = static_cast<unsigned>(std::min<size_t>(threads, jobs.size()));
+
+        std::atomic<size_t> next_job{ 0 };
+        std::atomic<size_t> failures{ 0 };
+        std::mutex report_lock;
+
+        auto report = [&](const batch_job& job, std::string message) {
+            while (!message.empty() && message.back() == '\n') {
+                message.pop_back();
+            }
+            std::lock_guard<std::mutex> lock{ report_lock };
+            fprintf(stderr, "%s: %s\n", job.infile.c_str(), message.c_str());
+            ++failures;
+        };
+
+        // Each worker takes the next unclaimed job until there are none left.
+        auto worker = [&]() {
+            for (size_t i = next_job++; i < jobs.size(); i = next_job++) {
+                try {
+                    convert(jobs[i]);
+                }
+                catch (const error::xcom_exception& e) {
+                    report(jobs[i], e.what());
+                }
+                catch (const std::exception& e) {
+                    report(jobs[i], e.what());
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; ++i) {
+            pool.emplace_back(worker);
+        }
+        worker();
+
+        for (std::thread& t : pool) {
+            t.join();
+        }
+        return failures;
+    }
+}
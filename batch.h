@@ -0,0 +1,55 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace xcom
+{
+    // One file to convert in a batch.
+    struct batch_job
+    {
+        std::string infile;
+        std::string outfile;
+    };
+
+    // Expand the input arguments of a batch into a list of files. Each
+    // argument is a file, a directory, or @<listfile> naming a text file
+    // with one input per line. Directories contribute the files directly in
+    // them for which accept() returns true.
+    std::vector<std::string> expand_batch_inputs(const std::vector<std::string>& args,
+        const std::function<bool(const std::string&)>& accept);
+
+    // Check that no two jobs write the same output file, which would have
+    // two workers writing it at once. Throws naming both inputs if they do.
+    // Paths are compared as given.
+    void check_batch_outputs(const std::vector<batch_job>& jobs);
+
+    // Run convert() on each job using up to 'threads' worker threads (0 for
+    // one per core). A failure is reported on stderr and doesn't stop the
+    // other jobs. Returns the number of jobs that failed.
+    size_t run_batch(const std::vector<batch_job>& jobs, unsigned threads,
+        const std::function<void(const batch_job&)>& convert);
+}
+
+#endif // BATCH_H
@@ -0,0 +1,434 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "cbor.h"
+#include "jsonreader.h"
+
+#include <cstring>
+
+using namespace json11;
+using namespace xcom;
+
+namespace
+{
+    // CBOR major types
+    const unsigned char major_unsigned = 0;
+    const unsigned char major_negative = 1;
+    const unsigned char major_bytes = 2;
+    const unsigned char major_text = 3;
+    const unsigned char major_array = 4;
+    const unsigned char major_map = 5;
+    const unsigned char major_simple = 7;
+
+    // Initial bytes with special meanings
+    const unsigned char cbor_false = 0xf4;
+    const unsigned char cbor_true = 0xf5;
+    const unsigned char cbor_null = 0xf6;
+    const unsigned char cbor_float32 = 0xfa;
+    const unsigned char cbor_float64 = 0xfb;
+    const unsigned char cbor_break = 0xff;
+    const unsigned char indefinite = 31;
+
+    // Flush the output once this much is buffered.
+    const size_t flush_size = 64 * 1024;
+
+    // Deeper nesting than any save has is assumed to be garbage.
+    const int max_depth = 256;
+}
+
+void cbor_writer::write_head(unsigned char major, uint64_t value)
+{
+    unsigned char m = static_cast<unsigned char>(major << 5);
+    if (value < 24) {
+        buf.push_back(m | static_cast<unsigned char>(value));
+    }
+    else if (value <= 0xff) {
+        buf.push_back(m | 24);
+        buf.push_back(static_cast<unsigned char>(value));
+    }
+    else if (value <= 0xffff) {
+        buf.push_back(m | 25);
+        buf.push_back(static_cast<unsigned char>(value >> 8));
+        buf.push_back(static_cast<unsigned char>(value));
+    }
+    else if (value <= 0xffffffff) {
+        buf.push_back(m | 26);
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            buf.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+    else {
+        buf.push_back(m | 27);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            buf.push_back(static_cast<unsigned char>(value >> shift));
+        }
+    }
+}
+
+void cbor_writer::write_text(const std::string& str)
+{
+    write_head(major_text, str.size());
+    buf.insert(buf.end(), str.begin(), str.end());
+    if (buf.size() >= flush_size) {
+        flush();
+    }
+}
+
+void cbor_writer::flush()
+{
+    out.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    buf.clear();
+}
+
+void cbor_writer::begin_object(bool)
+{
+    buf.push_back(static_cast<unsigned char>(major_map << 5) | indefinite);
+}
+
+void cbor_writer::end_object()
+{
+    buf.push_back(cbor_break);
+}
+
+void cbor_writer::begin_array(bool)
+{
+    buf.push_back(static_cast<unsigned char>(major_array << 5) | indefinite);
+}
+
+void cbor_writer::end_array()
+{
+    buf.push_back(cbor_break);
+}
+
+void cbor_writer::end_item(bool)
+{
+}
+
+void cbor_writer::write_key(const std::string &name)
+{
+    write_text(name);
+}
+
+void cbor_writer::write_int(const std::string &name, int32_t val, bool omit_newline)
+{
+    write_key(name);
+    write_raw_int(val, omit_newline);
+}
+
+void cbor_writer::write_raw_int(int val, bool)
+{
+    if (val >= 0) {
+        write_head(major_unsigned, static_cast<uint64_t>(val));
+    }
+    else {
+        write_head(major_negative, static_cast<uint64_t>(-1 - static_cast<int64_t>(val)));
+    }
+}
+
+void cbor_writer::write_float(const std::string &name, float val, bool omit_newline)
+{
+    write_key(name);
+    write_raw_float(val, omit_newline);
+}
+
+void cbor_writer::write_raw_float(float val, bool)
+{
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof bits);
+    buf.push_back(cbor_float32);
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        buf.push_back(static_cast<unsigned char>(bits >> shift));
+    }
+}
+
+void cbor_writer::write_string(const std::string &name, const std::string &val, bool)
+{
+    write_key(name);
+    write_text(val);
+}
+
+void cbor_writer::write_unicode_string(const std::string& name, const xcom_string& str)
+{
+    write_key(name);
+    write_raw_unicode_string(str);
+}
+
+void cbor_writer::write_raw_unicode_string(const xcom_string& str)
+{
+    begin_object(true);
+    write_string("str", str.str, true);
+    write_bool("is_wide", str.is_wide, true);
+    end_object();
+}
+
+void cbor_writer::write_raw_string(const std::string& val, bool)
+{
+    write_text(val);
+}
+
+void cbor_writer::write_bool(const std::string &name, bool val, bool)
+{
+    write_key(name);
+    buf.push_back(val ? cbor_true : cbor_false);
+}
+
+void cbor_writer::write_bytes(const std::string &name, const unsigned char *data, size_t length, bool)
+{
+    write_key(name);
+    write_head(major_bytes, length);
+    if (length > 0) {
+        buf.insert(buf.end(), data, data + length);
+    }
+    if (buf.size() >= flush_size) {
+        flush();
+    }
+}
+
+bool is_cbor(const unsigned char *data, size_t length)
+{
+    // The top level is always an object, and json text starts with '{' or
+    // whitespace, neither of which is a CBOR map.
+    return length > 0 && (data[0] >> 5) == major_map;
+}
+
+namespace
+{
+    class cbor_reader
+    {
+    public:
+        cbor_reader(const unsigned char *data, size_t length) :
+            data_(data), length_(length), pos_(0) {}
+
+        Json read_document()
+        {
+            Json json = read_item(0);
+            if (pos_ != length_) {
+                fail("trailing data");
+            }
+            return json;
+        }
+
+    private:
+        [[noreturn]] void fail(const char *why) const
+        {
+            throw error::general_exception("invalid cbor at offset " + std::to_string(pos_) + ": " + why);
+        }
+
+        unsigned char next_byte()
+        {
+            if (pos_ >= length_) {
+                fail("unexpected end of data");
+            }
+            return data_[pos_++];
+        }
+
+        uint64_t read_uint(size_t bytes)
+        {
+            if (length_ - pos_ < bytes) {
+                fail("unexpected end of data");
+            }
+            uint64_t value = 0;
+            for (size_t i = 0; i < bytes; ++i) {
+                value = (value << 8) | data_[pos_++];
+            }
+            return value;
+        }
+
+        // Read the argument of an initial byte. Returns false for an
+        // indefinite length.
+        bool read_argument(unsigned char info, uint64_t& value)
+        {
+            if (info < 24) {
+                value = info;
+            }
+            else if (info == 24) {
+                value = read_uint(1);
+            }
+            else if (info == 25) {
+                value = read_uint(2);
+            }
+            else if (info == 26) {
+                value = read_uint(4);
+            }
+            else if (info == 27) {
+                value = read_uint(8);
+            }
+            else if (info == indefinite) {
+                return false;
+            }
+            else {
+                fail("reserved length");
+            }
+            return true;
+        }
+
+        bool at_break()
+        {
+            if (pos_ >= length_) {
+                fail("unexpected end of data");
+            }
+            if (data_[pos_] == cbor_break) {
+                ++pos_;
+                return true;
+            }
+            return false;
+        }
+
+        std::string read_string_data(unsigned char major, unsigned char info)
+        {
+            uint64_t length;
+            if (!read_argument(info, length)) {
+                // Indefinite strings are a series of definite chunks.
+                std::string str;
+                while (!at_break()) {
+                    unsigned char initial = next_byte();
+                    if ((initial >> 5) != major || (initial & 0x1f) == indefinite) {
+                        fail("invalid string chunk");
+                    }
+                    str += read_string_data(major, initial & 0x1f);
+                }
+                return str;
+            }
+
+            if (length > length_ - pos_) {
+                fail("string past end of data");
+            }
+            std::string str(reinterpret_cast<const char*>(data_ + pos_), static_cast<size_t>(length));
+            pos_ += static_cast<size_t>(length);
+            return str;
+        }
+
+        static Json number(int64_t value)
+        {
+            if (value >= INT32_MIN && value <= INT32_MAX) {
+                return Json(static_cast<int>(value));
+            }
+            return Json(static_cast<double>(value));
+        }
+
+        Json read_item(int depth)
+        {
+            if (depth > max_depth) {
+                fail("nested too deeply");
+            }
+
+            unsigned char initial = next_byte();
+            unsigned char major = initial >> 5;
+            unsigned char info = initial & 0x1f;
+            uint64_t value = 0;
+
+            switch (major)
+            {
+            case major_unsigned:
+                if (!read_argument(info, value) || value > INT64_MAX) {
+                    fail("invalid integer");
+                }
+                return number(static_cast<int64_t>(value));
+
+            case major_negative:
+                if (!read_argument(info, value) || value > INT64_MAX) {
+                    fail("invalid integer");
+                }
+                return number(-1 - static_cast<int64_t>(value));
+
+            case major_bytes:
+            {
+                // Passed on as raw bytes: see raw_bytes_tag.
+                std::string bytes = read_string_data(major, info);
+                return Json(bytes.empty() ? std::string() : raw_bytes_tag + bytes);
+            }
+
+            case major_text:
+                return Json(read_string_data(major, info));
+
+            case major_array:
+            {
+                Json::array items;
+                if (read_argument(info, value)) {
+                    if (value > length_ - pos_) {
+                        fail("array past end of data");
+                    }
+                    items.reserve(static_cast<size_t>(value));
+                    for (uint64_t i = 0; i < value; ++i) {
+                        items.push_back(read_item(depth + 1));
+                    }
+                }
+                else {
+                    while (!at_break()) {
+                        items.push_back(read_item(depth + 1));
+                    }
+                }
+                return Json(std::move(items));
+            }
+
+            case major_map:
+            {
+                Json::object members;
+                bool definite = read_argument(info, value);
+                for (uint64_t i = 0; definite ? i < value : !at_break(); ++i) {
+                    Json key = read_item(depth + 1);
+                    if (!key.is_string()) {
+                        fail("map key is not a string");
+                    }
+                    members[key.string_value()] = read_item(depth + 1);
+                }
+                return Json(std::move(members));
+            }
+
+            case major_simple:
+                if (initial == cbor_false) {
+                    return Json(false);
+                }
+                else if (initial == cbor_true) {
+                    return Json(true);
+                }
+                else if (initial == cbor_null) {
+                    return Json(nullptr);
+                }
+                else if (initial == cbor_float32) {
+                    uint32_t bits = static_cast<uint32_t>(read_uint(4));
+                    float f;
+                    memcpy(&f, &bits, sizeof f);
+                    return Json(static_cast<double>(f));
+                }
+                else if (initial == cbor_float64) {
+                    uint64_t bits = read_uint(8);
+                    double d;
+                    memcpy(&d, &bits, sizeof d);
+                    return Json(d);
+                }
+                fail("unsupported simple value");
+
+            default:
+                // Tags (major type 6) are never written.
+                fail("unsupported item");
+            }
+        }
+
+        const unsigned char *data_;
+        size_t length_;
+        size_t pos_;
+    };
+}
+
+Json parse_cbor(const unsigned char *data, size_t length)
+{
+    cbor_reader r{ data, length };
+    return r.read_document();
+}
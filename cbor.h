@@ -0,0 +1,84 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef CBOR_H
+#define CBOR_H
+
+#include "jsonwriter.h"
+#include "json11.hpp"
+
+#include <vector>
+
+// Writes a save as CBOR (RFC 7049) with the same structure as the json
+// output. Byte data is stored as byte strings rather than hex, floats as
+// 32-bit floats, and objects and arrays use indefinite lengths so they can
+// be written in a single pass.
+struct cbor_writer : document_writer
+{
+    cbor_writer(const std::string& filename) :
+        file(filename), out(file) {}
+
+    cbor_writer(std::ostream& stream) :
+        out(stream) {}
+
+    ~cbor_writer()
+    {
+        flush();
+    }
+
+    void begin_object(bool omit_newline = false) override;
+    void end_object() override;
+    void begin_array(bool omit_newline = false) override;
+    void end_array() override;
+    void end_item(bool omit_newline) override;
+    void write_key(const std::string &name) override;
+    void write_int(const std::string &name, int32_t val, bool omit_newline = false) override;
+    void write_raw_int(int val, bool omit_newline = false) override;
+    void write_float(const std::string &name, float val, bool omit_newline = false) override;
+    void write_raw_float(float val, bool omit_newline = false) override;
+    void write_string(const std::string &name, const std::string &val,
+            bool omit_newline = false) override;
+    void write_unicode_string(const std::string& name, const xcom::xcom_string& str) override;
+    void write_raw_unicode_string(const xcom::xcom_string& str) override;
+    void write_raw_string(const std::string& val, bool omit_newline = false) override;
+    void write_bool(const std::string &name, bool val, bool omit_newline = false) override;
+    void write_bytes(const std::string &name, const unsigned char *data, size_t length,
+            bool omit_newline = false) override;
+
+    // Write any buffered output to the stream.
+    void flush();
+
+private:
+    void write_head(unsigned char major, uint64_t value);
+    void write_text(const std::string& str);
+
+    std::ofstream file;
+    std::ostream& out;
+    std::vector<unsigned char> buf;
+};
+
+// True if data looks like CBOR written by cbor_writer rather than json text.
+bool is_cbor(const unsigned char *data, size_t length);
+
+// Decode CBOR into the json representation read by build_save(). Byte
+// strings become strings of the raw bytes after raw_bytes_tag, which
+// build_save() copies without any hex decoding.
+json11::Json parse_cbor(const unsigned char *data, size_t length);
+
+#endif // CBOR_H
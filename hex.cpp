@@ -0,0 +1,270 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+/*
+hex.cpp - Hex encoding and decoding of raw property data.
+
+Native struct data and the contents of unknown arrays are written to json as
+hex, so large saves spend a fair amount of time here. On x86-64 blocks of 16
+bytes are handled with SSE2, which every x86-64 processor has, and blocks of
+32 with AVX2 where the processor supports it. Anything left over is handled a
+byte at a time, as is everything on other platforms.
+*/
+
+#include "xcom.h"
+#include "util.h"
+
+#include <array>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define XCOM_HEX_SIMD
+#include <immintrin.h>
+#endif
+
+// GCC and clang only allow AVX2 intrinsics in functions that ask for them.
+#if defined(XCOM_HEX_SIMD) && (defined(__GNUC__) || defined(__clang__))
+#define XCOM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define XCOM_TARGET_AVX2
+#endif
+
+namespace xcom
+{
+    namespace util
+    {
+        static const char hex_digits[] = "0123456789abcdef";
+
+        // The value of each character as a hex digit in either case, or -1.
+        static const std::array<int8_t, 256> hex_values = []() {
+            std::array<int8_t, 256> values;
+            values.fill(-1);
+            for (int i = 0; i < 10; ++i) {
+                values['0' + i] = static_cast<int8_t>(i);
+            }
+            for (int i = 0; i < 6; ++i) {
+                values['a' + i] = values['A' + i] = static_cast<int8_t>(10 + i);
+            }
+            return values;
+        }();
+
+        static int hex_value(char c)
+        {
+            return hex_values[static_cast<unsigned char>(c)];
+        }
+
+        static void to_hex_scalar(const unsigned char *data, size_t length, char *out)
+        {
+            for (size_t i = 0; i < length; ++i) {
+                out[2 * i] = hex_digits[data[i] >> 4];
+                out[2 * i + 1] = hex_digits[data[i] & 0x0F];
+            }
+        }
+
+        // Decode length / 2 bytes. 'offset' is where str starts in the whole
+        // string, for error messages.
+        static void from_hex_scalar(const char *str, size_t length, unsigned char *out, size_t offset)
+        {
+            for (size_t i = 0; i < length; i += 2) {
+                int hi = hex_value(str[i]);
+                int lo = hex_value(str[i + 1]);
+                if (hi < 0 || lo < 0) {
+                    size_t bad = (hi < 0) ? i : i + 1;
+                    std::string message = "unexpected hex character '";
+                    message.append(1, str[bad]);
+                    message += "' at offset " + std::to_string(offset + bad);
+                    throw error::general_exception(message);
+                }
+                out[i / 2] = static_cast<unsigned char>((hi << 4) | lo);
+            }
+        }
+
+#ifdef XCOM_HEX_SIMD
+        // Turn 16 bytes of nibbles into their hex digits: nibble + '0', plus
+        // the distance from '9' + 1 to 'a' for nibbles over 9.
+        static inline __m128i nibbles_to_hex_sse2(__m128i nibbles)
+        {
+            __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                _mm_set1_epi8('a' - '0' - 10));
+            return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+        }
+
+        static size_t to_hex_sse2(const unsigned char *data, size_t length, char *out)
+        {
+            const __m128i low_nibble = _mm_set1_epi8(0x0F);
+            size_t i = 0;
+            for (; i + 16 <= length; i += 16) {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+                __m128i hi = nibbles_to_hex_sse2(_mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble));
+                __m128i lo = nibbles_to_hex_sse2(_mm_and_si128(bytes, low_nibble));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+            }
+            return i;
+        }
+
+        // The values of 16 hex digits, with a mask of the valid ones.
+        static inline __m128i hex_to_nibbles_sse2(__m128i chars, int& valid)
+        {
+            // Digits are 0-9 after subtracting '0'. Folding to lower case
+            // and subtracting 'a' makes letters 0-5.
+            __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+            __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+            __m128i is_digit = _mm_and_si128(_mm_cmpgt_epi8(digit, _mm_set1_epi8(-1)),
+                _mm_cmplt_epi8(digit, _mm_set1_epi8(10)));
+            __m128i is_letter = _mm_and_si128(_mm_cmpgt_epi8(letter, _mm_set1_epi8(-1)),
+                _mm_cmplt_epi8(letter, _mm_set1_epi8(6)));
+            valid = _mm_movemask_epi8(_mm_or_si128(is_digit, is_letter));
+            return _mm_or_si128(_mm_and_si128(is_digit, digit),
+                _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+        }
+
+        // Combine pairs of nibbles (high first) into bytes, one per 16-bit lane.
+        static inline __m128i pair_nibbles_sse2(__m128i nibbles)
+        {
+            __m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+            return _mm_or_si128(hi, _mm_srli_epi16(nibbles, 8));
+        }
+
+        // Decode blocks of 32 characters, stopping at the first block with
+        // an invalid character so the scalar code can report it.
+        static size_t from_hex_sse2(const char *str, size_t length, unsigned char *out)
+        {
+            size_t i = 0;
+            for (; i + 32 <= length; i += 32) {
+                int valid_a, valid_b;
+                __m128i a = hex_to_nibbles_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i)), valid_a);
+                __m128i b = hex_to_nibbles_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(str + i + 16)), valid_b);
+                if ((valid_a & valid_b) != 0xFFFF) {
+                    break;
+                }
+                __m128i bytes = _mm_packus_epi16(pair_nibbles_sse2(a), pair_nibbles_sse2(b));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 2), bytes);
+            }
+            return i;
+        }
+
+        XCOM_TARGET_AVX2 static inline __m256i nibbles_to_hex_avx2(__m256i nibbles)
+        {
+            __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(nibbles, _mm256_set1_epi8(9)),
+                _mm256_set1_epi8('a' - '0' - 10));
+            return _mm256_add_epi8(_mm256_add_epi8(nibbles, _mm256_set1_epi8('0')), letters);
+        }
+
+        XCOM_TARGET_AVX2 static size_t to_hex_avx2(const unsigned char *data, size_t length, char *out)
+        {
+            const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+            size_t i = 0;
+            for (; i + 32 <= length; i += 32) {
+                __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                __m256i hi = nibbles_to_hex_avx2(_mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibble));
+                __m256i lo = nibbles_to_hex_avx2(_mm256_and_si256(bytes, low_nibble));
+                // The unpacks work within each 128-bit half: put the halves
+                // back in order.
+                __m256i first = _mm256_unpacklo_epi8(hi, lo);
+                __m256i second = _mm256_unpackhi_epi8(hi, lo);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                    _mm256_permute2x128_si256(first, second, 0x20));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32),
+                    _mm256_permute2x128_si256(first, second, 0x31));
+            }
+            return i;
+        }
+
+        XCOM_TARGET_AVX2 static inline __m256i hex_to_nibbles_avx2(__m256i chars, uint32_t& valid)
+        {
+            __m256i digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+            __m256i letter = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+            __m256i is_digit = _mm256_and_si256(_mm256_cmpgt_epi8(digit, _mm256_set1_epi8(-1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(10), digit));
+            __m256i is_letter = _mm256_and_si256(_mm256_cmpgt_epi8(letter, _mm256_set1_epi8(-1)),
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(6), letter));
+            valid = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)));
+            return _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+        }
+
+        XCOM_TARGET_AVX2 static inline __m256i pair_nibbles_avx2(__m256i nibbles)
+        {
+            __m256i hi = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00FF)), 4);
+            return _mm256_or_si256(hi, _mm256_srli_epi16(nibbles, 8));
+        }
+
+        XCOM_TARGET_AVX2 static size_t from_hex_avx2(const char *str, size_t length, unsigned char *out)
+        {
+            size_t i = 0;
+            for (; i + 64 <= length; i += 64) {
+                uint32_t valid_a, valid_b;
+                __m256i a = hex_to_nibbles_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i)), valid_a);
+                __m256i b = hex_to_nibbles_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + i + 32)), valid_b);
+                if ((valid_a & valid_b) != 0xFFFFFFFF) {
+                    break;
+                }
+                // The pack also works within each half, leaving the quarters
+                // in the order a0 b0 a1 b1.
+                __m256i bytes = _mm256_packus_epi16(pair_nibbles_avx2(a), pair_nibbles_avx2(b));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i / 2),
+                    _mm256_permute4x64_epi64(bytes, 0xD8));
+            }
+            return i;
+        }
+
+#endif
+
+        void to_hex(const unsigned char *data, size_t length, char *out)
+        {
+            size_t done = 0;
+#ifdef XCOM_HEX_SIMD
+            done = have_avx2() ? to_hex_avx2(data, length, out) : 0;
+            done += to_hex_sse2(data + done, length - done, out + 2 * done);
+#endif
+            to_hex_scalar(data + done, length - done, out + 2 * done);
+        }
+
+        void from_hex(const char *str, size_t length, unsigned char *out)
+        {
+            if (length % 2 != 0) {
+                throw error::general_exception("hex data has an odd number of characters: " +
+                    std::to_string(length));
+            }
+
+            size_t done = 0;
+#ifdef XCOM_HEX_SIMD
+            done = have_avx2() ? from_hex_avx2(str, length, out) : 0;
+            done += from_hex_sse2(str + done, length - done, out + done / 2);
+#endif
+            from_hex_scalar(str + done, length - done, out + done / 2, done);
+        }
+
+        std::string to_hex(const unsigned char *data, size_t length)
+        {
+            std::string str(2 * length, '\0');
+            to_hex(data, length, &str[0]);
+            return str;
+        }
+
+        std::unique_ptr<unsigned char[]> from_hex(const std::string &str)
+        {
+            std::unique_ptr<unsigned char[]> data =
+                std::make_unique<unsigned char[]>(str.length() / 2);
+            from_hex(str.data(), str.length(), data.get());
+            return data;
+        }
+    }
+}
@@ -0,0 +1,859 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "jsonreader.h"
+#include "util.h"
+
+#include <cstring>
+#include <sstream>
+
+using namespace json11;
+using namespace xcom;
+
+struct property_dispatch
+{
+    std::string name;
+    property_ptr(*func)(const Json& json, xcom_version version);
+};
+
+property_ptr build_property(const Json& json, xcom_version version);
+property_list build_property_list(const Json& json, xcom_version version);
+
+property_ptr build_int_property(const Json& json, xcom_version version);
+property_ptr build_float_property(const Json& json, xcom_version version);
+property_ptr build_bool_property(const Json& json, xcom_version version);
+property_ptr build_object_property(const Json& json, xcom_version version);
+property_ptr build_string_property(const Json& json, xcom_version version);
+property_ptr build_name_property(const Json& json, xcom_version version);
+property_ptr build_enum_property(const Json& json, xcom_version version);
+property_ptr build_struct_property(const Json& json, xcom_version version);
+property_ptr build_array_property(const Json& json, xcom_version version);
+property_ptr build_static_array_property(const Json& json, xcom_version version);
+property_ptr build_object_array_property(const Json& json, xcom_version version);
+property_ptr build_number_array_property(const Json& json, xcom_version version);
+property_ptr build_string_array_property(const Json& json, xcom_version version);
+property_ptr build_enum_array_property(const Json& json, xcom_version version);
+property_ptr build_struct_array_property(const Json& json, xcom_version version);
+
+struct json_shape_exception : xcom::error::xcom_exception
+{
+    json_shape_exception(const std::string& n, const std::string& e) : node_ {n}, error_{e} {}
+    virtual std::string what() const noexcept
+    {
+            std::ostringstream stream;
+            stream << "Error: invalid json format in " << node_ << ": " << error_ << std::endl;
+            return stream.str(); 
+    }
+
+private:
+    std::string node_;
+    std::string error_;
+};
+
+static property_dispatch dispatch_table[] = {
+    { "IntProperty", build_int_property },
+    { "FloatProperty", build_float_property },
+    { "BoolProperty", build_bool_property },
+    { "StrProperty", build_string_property },
+    { "NameProperty", build_name_property },
+    { "ObjectProperty", build_object_property },
+    { "ByteProperty", build_enum_property },
+    { "StructProperty", build_struct_property },
+    { "ArrayProperty", build_array_property },
+    { "StaticArrayProperty", build_static_array_property }
+};
+
+xcom_string build_unicode_string(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    Json::shape shape = {
+        { "str", Json::STRING },
+        { "is_wide", Json::BOOL }
+    };
+
+    std::string err;
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("unicode string", err);
+    }
+
+    return xcom_string{ json["str"].string_value(), json["is_wide"].bool_value() };
+}
+
+bool check_header_shape(xcom_version version, const Json& json, std::string &err)
+{
+    switch (version)
+    {
+    case xcom_version::enemy_within:
+    case xcom_version::enemy_unknown:
+        return json.has_shape({
+            { std::string("version"), Json::NUMBER },
+            { std::string("uncompressed_size"), Json::NUMBER },
+            { "game_number", Json::NUMBER },
+            { "save_number", Json::NUMBER },
+            { "save_description", Json::OBJECT },
+            { "time", Json::OBJECT },
+            { "map_command", Json::STRING },
+            { "tactical_save", Json::BOOL },
+            { "ironman", Json::BOOL },
+            { "autosave", Json::BOOL },
+            { "dlc", Json::STRING },
+            { "language", Json::STRING }
+        }, err);
+    case xcom_version::enemy_within_android:
+        return json.has_shape({
+            { "version", Json::NUMBER },
+            { "uncompressed_size", Json::NUMBER },
+            { "game_number", Json::NUMBER },
+            { "save_number", Json::NUMBER },
+            { "save_description", Json::OBJECT },
+            { "time", Json::OBJECT },
+            { "map_command", Json::STRING },
+            { "tactical_save", Json::BOOL },
+            { "ironman", Json::BOOL },
+            { "autosave", Json::BOOL },
+            { "dlc", Json::STRING },
+            { "language", Json::STRING },
+            { "profile_number", Json::NUMBER },
+            { "profile_date", Json::OBJECT },
+        }, err);
+    default:
+        throw xcom::error::unsupported_version(version);
+    }
+}
+
+header build_header(const Json& json)
+{
+    header hdr;
+
+    hdr.version = static_cast<xcom_version>(json["version"].int_value());
+    if (!supported_version(hdr.version)) {
+        throw xcom::error::unsupported_version(hdr.version);
+    }
+
+    // The header shape depends on the version.
+    std::string err;
+    if (!check_header_shape(hdr.version, json, err)) {
+        throw json_shape_exception("header", err);
+    }
+
+    hdr.uncompressed_size = json["uncompressed_size"].int_value();
+    hdr.game_number = json["game_number"].int_value();
+    hdr.save_number = json["save_number"].int_value();
+    hdr.save_description = build_unicode_string(json["save_description"], hdr.version);
+    hdr.time = build_unicode_string(json["time"], hdr.version);
+    hdr.map_command = json["map_command"].string_value();
+    hdr.tactical_save = json["tactical_save"].bool_value();
+    hdr.ironman = json["ironman"].bool_value();
+    hdr.autosave = json["autosave"].bool_value();
+    hdr.dlc = json["dlc"].string_value();
+    hdr.language = json["language"].string_value();
+
+    if (hdr.version == xcom_version::enemy_within_android) {
+        hdr.profile_number = json["profile_number"].int_value();
+        hdr.profile_date = build_unicode_string(json["profile_date"], hdr.version);
+    }
+
+    return hdr;
+}
+
+actor_table build_actor_table(const Json& json)
+{
+    actor_table table;
+    for (const Json& elem : json.array_items()) {
+        table.push_back(elem.string_value());
+    }
+    return table;
+}
+
+template <typename T>
+static T value_from_json(const Json& json);
+
+template <>
+int value_from_json(const Json& json)
+{
+    return json.int_value();
+}
+
+template <>
+float value_from_json(const Json& json)
+{
+    return static_cast<float>(json.number_value());
+}
+
+
+template <typename T>
+std::array<T, 3> build_array(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::array<T, 3> arr;
+    if (json.array_items().size() != 3) {
+        std::ostringstream stream;
+        stream << "expected 3 items but got " << json.array_items().size() << ": " << json.dump();
+        throw json_shape_exception("vector/rotator array", stream.str());
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        arr[i] = value_from_json<T>(json.array_items()[i]);
+    }
+
+    return arr;
+}
+
+
+
+property_ptr build_int_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "value", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("int property", err);
+    }
+
+    return std::make_unique<int_property>(json["name"].string_value(), 
+        json["value"].int_value());
+}
+
+property_ptr build_float_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "value", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("float property", err);
+    }
+
+    return std::make_unique<float_property>(json["name"].string_value(), 
+            static_cast<float>(json["value"].number_value()));
+}
+
+property_ptr build_bool_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "value", Json::BOOL }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("bool property", err);
+    }
+
+    return std::make_unique<bool_property>(json["name"].string_value(), 
+        json["value"].bool_value());
+}
+
+property_ptr build_string_property(const Json& json, xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "value", Json::OBJECT }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("string property", err);
+    }
+    return std::make_unique<string_property>(json["name"].string_value(),
+        build_unicode_string(json["value"], version));
+}
+
+property_ptr build_name_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "string", Json::STRING },
+        { "number", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("name property", err);
+    }
+
+    return std::make_unique<name_property>(json["name"].string_value(),
+        json["string"].string_value(), json["number"].int_value());
+}
+
+property_ptr build_object_property(const Json& json, xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "actor", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("object property", err);
+    }
+    if (version == xcom_version::enemy_unknown)
+    {
+        return std::make_unique<object_property_EU>(json["name"].string_value(),
+            json["actor"].int_value());
+    }
+    else
+    {
+        return std::make_unique<object_property>(json["name"].string_value(),
+            json["actor"].int_value());
+    }
+}
+
+property_ptr build_enum_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "type", Json::STRING },
+        { "value", Json::STRING },
+        { "number", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("enum property", err);
+    }
+
+    return std::make_unique<enum_property>(json["name"].string_value(), 
+        json["type"].string_value(), json["value"].string_value(), 
+        json["number"].int_value());
+}
+
+// Decode bytes written by json_writer::write_bytes(): hex, or base64 after a
+// "base64:" tag. Raw bytes from parse_cbor() are copied as they are.
+static std::unique_ptr<unsigned char[]> decode_bytes(const std::string& str, size_t& length)
+{
+    if (str.compare(0, raw_bytes_tag.length(), raw_bytes_tag) == 0) {
+        length = str.length() - raw_bytes_tag.length();
+        std::unique_ptr<unsigned char[]> data = std::make_unique<unsigned char[]>(length);
+        memcpy(data.get(), str.data() + raw_bytes_tag.length(), length);
+        return data;
+    }
+
+    static const std::string tag = "base64:";
+    if (str.compare(0, tag.length(), tag) == 0) {
+        length = util::from_base64_size(str.data() + tag.length(), str.length() - tag.length());
+        std::unique_ptr<unsigned char[]> data = std::make_unique<unsigned char[]>(length);
+        util::from_base64(str.data() + tag.length(), str.length() - tag.length(), data.get());
+        return data;
+    }
+
+    length = str.length() / 2;
+    return util::from_hex(str);
+}
+
+property_ptr build_struct_property(const Json& json, xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "struct_name", Json::STRING },
+        { "properties", Json::ARRAY },
+        { "native_data", Json::STRING },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("struct property", err);
+    }
+
+    std::unique_ptr<unsigned char[]> data;
+    const std::string & native_data_str = json["native_data"].string_value();
+    if (native_data_str != "") {
+        size_t data_len;
+        data = decode_bytes(native_data_str, data_len);
+        return std::make_unique<struct_property>(json["name"].string_value(), 
+            json["struct_name"].string_value(), std::move(data), static_cast<int32_t>(data_len));
+    }
+    else {
+        property_list props = build_property_list(json["properties"], version);
+        return std::make_unique<struct_property>(json["name"].string_value(), 
+            json["struct_name"].string_value(), std::move(props));
+    }
+}
+
+property_ptr build_array_property(const Json& json, xcom_version version)
+{
+    // Handle array sub-types
+    if (json["actors"] != Json()) {
+        return build_object_array_property(json, version);
+    }
+    else if (json["elements"] != Json()) {
+        return build_number_array_property(json, version);
+    }
+    else if (json["structs"] != Json()) {
+        return build_struct_array_property(json, version);
+    }
+    else if (json["strings"] != Json()) {
+        return build_string_array_property(json, version);
+    }
+    else if (json["enum_values"] != Json()) {
+        return build_enum_array_property(json, version);
+    }
+
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "data_length", Json::NUMBER },
+        { "array_bound", Json::NUMBER },
+        { "data", Json::STRING },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("array property", err);
+    }
+
+    const std::string & data_str = json["data"].string_value();
+    std::unique_ptr<unsigned char[]> data;
+
+    if (data_str.length() > 0) {
+        size_t data_len;
+        data = decode_bytes(data_str, data_len);
+        if (static_cast<int32_t>(data_len) != json["data_length"].int_value()) {
+            throw json_shape_exception("array property", "data doesn't match data_length");
+        }
+    }
+
+    return std::make_unique<array_property>(json["name"].string_value(), std::move(data),
+        json["data_length"].int_value(), json["array_bound"].int_value());
+}
+
+property_ptr build_object_array_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "actors", Json::ARRAY },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("object array property", err);
+    }
+
+    const Json::array& actors = json["actors"].array_items();
+    array_elements elements;
+    elements.reserve(actors.size());
+
+    for (const Json& elem : actors) {
+        elements.push_back(elem.int_value());
+    }
+
+    return std::make_unique<object_array_property>(json["name"].string_value(), std::move(elements));
+}
+
+property_ptr build_number_array_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "elements", Json::ARRAY },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("number array property", err);
+    }
+
+    const Json::array& items = json["elements"].array_items();
+    array_elements elements;
+    elements.reserve(items.size());
+
+    for (const Json& elem : items) {
+        elements.push_back(elem.int_value());
+    }
+
+    return std::make_unique<number_array_property>(json["name"].string_value(), std::move(elements));
+}
+
+property_ptr build_string_array_property(const Json& json, xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "strings", Json::ARRAY },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("string array property", err);
+    }
+
+    std::vector<xcom_string> elements;
+
+    for (const Json& elem : json["strings"].array_items()) {
+        elements.push_back(build_unicode_string(elem, version));
+    }
+
+    return std::make_unique<string_array_property>(json["name"].string_value(), std::move(elements));
+}
+
+property_ptr build_enum_array_property(const Json& json, [[maybe_unused]] xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "enum_values", Json::ARRAY },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("enum array property", err);
+    }
+
+    std::vector<enum_value> elements;
+
+    for (const Json& elem : json["enum_values"].array_items()) {
+        std::string name = elem["value"].string_value();
+        int32_t number = elem["number"].int_value();
+        elements.push_back({ name, number });
+    }
+
+    return std::make_unique<enum_array_property>(json["name"].string_value(), std::move(elements));
+}
+
+property_ptr build_struct_array_property(const Json& json, xcom_version version)
+{
+    std::string err;
+
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "structs", Json::ARRAY },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("object array property", err);
+    }
+
+    std::vector<property_list> elements;
+
+    for (const Json& elem : json["structs"].array_items()) {
+        elements.push_back(build_property_list(elem, version));
+    }
+
+    return std::make_unique<struct_array_property>(json["name"].string_value(), 
+        std::move(elements));
+}
+
+property_ptr build_static_array_property(const Json& json, xcom_version version)
+{
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("static array property", err);
+    }
+
+    std::unique_ptr<static_array_property> static_array =
+        std::make_unique<static_array_property>(json["name"].string_value());
+
+    if (json["int_values"] != Json()) {
+        // An array of integers.
+        for (const Json &v : json["int_values"].array_items()) {
+            static_array->properties.push_back(
+                std::make_unique<int_property>(json["name"].string_value(),
+                    v.int_value()));
+        }
+    }
+    else if (json["string_values"] != Json()) {
+        // An array of (narrow) strings
+        for (const Json &v : json["string_values"].array_items()) {
+            static_array->properties.push_back(
+                std::make_unique<string_property>(json["name"].string_value(),
+                    xcom_string{ v.string_value(), false }));
+        }
+    }
+    else
+    {
+        for (const Json& elem : json["properties"].array_items()) {
+            static_array->properties.push_back(build_property(elem, version));
+        }
+    }
+    return property_ptr{ static_array.release() };
+}
+
+property_ptr build_property(const Json& json, xcom_version version)
+{
+    std::string kind = json["kind"].string_value();
+    for (const property_dispatch &dispatch : dispatch_table) {
+        if (dispatch.name.compare(kind) == 0) {
+            return dispatch.func(json, version);
+        }
+    }
+
+    std::string err = "Error reading json file: Unknown property kind: ";
+    err.append(kind);
+    throw xcom::error::general_exception(err);
+}
+
+property_list build_property_list(const Json& json, xcom_version version)
+{
+    property_list props;
+    for (const Json& elem : json.array_items()) {
+        props.push_back(build_property(elem, version));
+    }
+
+    return props;
+}
+
+checkpoint build_checkpoint(const Json& json, xcom_version version)
+{
+    checkpoint chk;
+    std::string err;
+    Json::shape shape = {
+        { "name", Json::STRING },
+        { "instance_name", Json::STRING },
+        { "vector", Json::ARRAY },
+        { "rotator", Json::ARRAY },
+        { "class_name", Json::STRING },
+        { "properties", Json::ARRAY },
+        { "template_index", Json::NUMBER },
+        { "pad_size", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("checkpoint", err);
+    }
+
+    chk.name = json["name"].string_value();
+    chk.instance_name = json["instance_name"].string_value();
+    chk.vector = build_array<float>(json["vector"], version);
+    chk.rotator = build_array<int>(json["rotator"], version);
+    chk.class_name = json["class_name"].string_value();
+    chk.properties = build_property_list(json["properties"], version);
+    chk.template_index = json["template_index"].int_value();
+    chk.pad_size = json["pad_size"].int_value();
+    return chk;
+}
+
+// Checkpoints are independent of each other, so with more than one thread
+// they're built in parallel. If several are bad, the first in the document is
+// the one reported, as it would be when building them one at a time.
+checkpoint_table build_checkpoint_table(const Json& json, xcom_version version, unsigned threads)
+{
+    const Json::array& items = json.array_items();
+    checkpoint_table table(items.size());
+    util::parallel_for(items.size(), threads, [&items, &table, version](size_t i) {
+        table[i] = build_checkpoint(items[i], version);
+    });
+    return table;
+}
+
+checkpoint_chunk build_checkpoint_chunk(const Json& json, xcom_version version, unsigned threads = 1)
+{
+    checkpoint_chunk chunk;
+    std::string err;
+    Json::shape shape = {
+        { "unknown_int1", Json::NUMBER },
+        { "game_type", Json::STRING },
+        { "checkpoint_table", Json::ARRAY },
+        { "unknown_int2", Json::NUMBER },
+        { "class_name", Json::STRING },
+        { "actor_table", Json::ARRAY },
+        { "unknown_int3", Json::NUMBER },
+        { "display_name", Json::STRING },
+        { "map_name", Json::STRING },
+        { "unknown_int4", Json::NUMBER }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("checkpoint chunk", err);
+    }
+
+    chunk.unknown_int1 = json["unknown_int1"].int_value();
+    chunk.game_type = json["game_type"].string_value();
+    chunk.checkpoints = build_checkpoint_table(json["checkpoint_table"], version, threads);
+    chunk.unknown_int2 = json["unknown_int2"].int_value();
+    chunk.class_name = json["class_name"].string_value();
+    chunk.actors = build_actor_table(json["actor_table"]);
+    chunk.unknown_int3 = json["unknown_int3"].int_value();
+    chunk.display_name = json["display_name"].string_value();
+    chunk.map_name = json["map_name"].string_value();
+    chunk.unknown_int4 = json["unknown_int4"].int_value();
+    return chunk;
+}
+
+checkpoint_chunk_table build_checkpoint_chunk_table(const Json& json, xcom_version version, unsigned threads)
+{
+    checkpoint_chunk_table table;
+    for (const Json& elem : json.array_items()) {
+        table.push_back(build_checkpoint_chunk(elem, version, threads));
+    }
+    return table;
+}
+
+saved_game build_save(const Json& json, unsigned threads)
+{
+    saved_game save;
+    std::string err;
+    Json::shape shape = {
+        { "header", Json::OBJECT },
+        { "actor_table", Json::ARRAY },
+        { "checkpoints", Json::ARRAY }
+    };
+
+    if (!json.has_shape(shape, err)) {
+        throw json_shape_exception("root", err);
+    }
+
+    save.hdr = build_header(json["header"]);
+    save.actors = build_actor_table(json["actor_table"]);
+    save.checkpoints = build_checkpoint_chunk_table(json["checkpoints"], save.hdr.version, threads);
+    return save;
+}
+
+saved_game build_save(const std::string& text, unsigned threads)
+{
+    std::string err;
+    Json json = Json::parse(text, err);
+    if (!err.empty()) {
+        throw json_shape_exception("document", err);
+    }
+    return build_save(json, threads);
+}
+
+// Put an ndjson record in its place in a table, growing the table as needed.
+template <typename T>
+static void place_record(std::vector<T>& table, std::vector<bool>& seen, const Json& index,
+    T&& value, const std::string& node)
+{
+    if (!index.is_number() || index.int_value() < 0) {
+        throw json_shape_exception(node, "bad index");
+    }
+
+    size_t i = static_cast<size_t>(index.int_value());
+    if (i >= table.size()) {
+        table.resize(i + 1);
+        seen.resize(i + 1);
+    }
+    if (seen[i]) {
+        throw json_shape_exception(node, "duplicate record for index " + std::to_string(i));
+    }
+    table[i] = std::move(value);
+    seen[i] = true;
+}
+
+static void check_no_gaps(const std::vector<bool>& seen, const std::string& node)
+{
+    for (size_t i = 0; i < seen.size(); ++i) {
+        if (!seen[i]) {
+            throw json_shape_exception(node, "missing record for index " + std::to_string(i));
+        }
+    }
+}
+
+saved_game build_save_from_ndjson(const std::string& text)
+{
+    std::vector<Json> records;
+    bool have_header = false;
+    saved_game save;
+
+    size_t line_number = 0;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string line = text.substr(pos, end - pos);
+        pos = end + 1;
+        ++line_number;
+
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::string err;
+        Json json = Json::parse(line, err);
+        if (!err.empty()) {
+            throw json_shape_exception("line " + std::to_string(line_number), err);
+        }
+
+        // Checkpoints can't be built without the version, so the header
+        // has to come first. Everything else may come in any order.
+        const std::string& kind = json["record"].string_value();
+        if (!have_header) {
+            if (kind != "header") {
+                throw json_shape_exception("line " + std::to_string(line_number), "expected a header record first");
+            }
+            save.hdr = build_header(json);
+            have_header = true;
+        }
+        else {
+            records.push_back(std::move(json));
+        }
+    }
+
+    if (!have_header) {
+        throw json_shape_exception("document", "no header record");
+    }
+
+    // Actor records may come in any order, so place their names first and
+    // build the table once they're all in.
+    std::vector<std::string> actor_names;
+    std::vector<bool> actors_seen;
+    std::vector<bool> chunks_seen;
+    std::vector<std::vector<bool>> checkpoints_seen;
+    std::vector<checkpoint_table> checkpoints;
+
+    for (const Json& json : records) {
+        const std::string& kind = json["record"].string_value();
+        if (kind == "actor") {
+            place_record(actor_names, actors_seen, json["index"], std::string(json["name"].string_value()), "actor record");
+        }
+        else if (kind == "chunk") {
+            place_record(save.checkpoints, chunks_seen, json["chunk"],
+                build_checkpoint_chunk(json, save.hdr.version), "chunk record");
+        }
+        else if (kind == "checkpoint") {
+            const Json& chunk = json["chunk"];
+            if (!chunk.is_number() || chunk.int_value() < 0) {
+                throw json_shape_exception("checkpoint record", "bad chunk index");
+            }
+            size_t c = static_cast<size_t>(chunk.int_value());
+            if (c >= checkpoints.size()) {
+                checkpoints.resize(c + 1);
+                checkpoints_seen.resize(c + 1);
+            }
+            place_record(checkpoints[c], checkpoints_seen[c], json["index"],
+                build_checkpoint(json, save.hdr.version), "checkpoint record");
+        }
+        else if (kind == "header") {
+            throw json_shape_exception("header record", "more than one header");
+        }
+        else {
+            throw json_shape_exception("record", "unknown record type: " + kind);
+        }
+    }
+
+    check_no_gaps(actors_seen, "actor record");
+    save.actors.reserve(actor_names.size());
+    for (const std::string& name : actor_names) {
+        save.actors.push_back(name);
+    }
+    check_no_gaps(chunks_seen, "chunk record");
+    if (checkpoints.size() > save.checkpoints.size()) {
+        throw json_shape_exception("checkpoint record", "no chunk record for chunk " +
+            std::to_string(checkpoints.size() - 1));
+    }
+    for (size_t c = 0; c < checkpoints.size(); ++c) {
+        check_no_gaps(checkpoints_seen[c], "checkpoint record");
+        save.checkpoints[c].checkpoints = std::move(checkpoints[c]);
+    }
+    return save;
+}
@@ -0,0 +1,44 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef JSONREADER_H
+#define JSONREADER_H
+
+#include "xcom.h"
+#include "json11.hpp"
+
+#include <string>
+
+// Marks a string holding byte data as the raw bytes themselves, which follow
+// the tag, rather than hex or base64 text. parse_cbor() produces these for
+// CBOR byte strings so they reach build_save() without being re-encoded.
+inline const std::string raw_bytes_tag{ "\0bytes:", 7 };
+
+// Build a save from the json produced by xcom2json, building the
+// checkpoints of each chunk on up to 'threads' threads (0 for one per core).
+xcom::saved_game build_save(const json11::Json& json, unsigned threads = 1);
+
+// Parse json text and build a save from it.
+xcom::saved_game build_save(const std::string& text, unsigned threads = 1);
+
+// Build a save from the newline-delimited json written by buildNdjson(). The
+// header must be the first line; the other lines may come in any order.
+xcom::saved_game build_save_from_ndjson(const std::string& text);
+
+#endif // JSONREADER_H
@@ -0,0 +1,569 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "jsonwriter.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <sstream>
+
+using namespace xcom;
+
+std::string json_escape(const std::string& str)
+{
+    std::string ret;
+
+    for (size_t i = 0; i < str.length(); ++i) {
+        switch (str[i])
+        {
+        case '"':
+            ret += "\\\"";
+            break;
+        case '\\':
+            ret += "\\\\";
+            break;
+        case '\n':
+            ret += "\\n";
+            break;
+        case '\r':
+            ret += "\\r";
+            break;
+        case '\t':
+            ret += "\\t";
+            break;
+        default:
+            if (str[i] > 0 && str[i] < ' ') {
+                std::string hex = 
+                    util::to_hex(reinterpret_cast<const unsigned char *>(&str[i]), 1);
+                ret += "\\u00";
+                ret += hex;
+            }
+            else {
+                ret += str[i];
+            }
+        }
+    }
+
+    return ret;
+}
+
+void json_writer::write_bytes(const std::string &name, const unsigned char *data, size_t length,
+        bool omit_newline)
+{
+    // Neither hex nor base64 digits need escaping, so they go straight to
+    // the output.
+    write_key(name);
+    if (length == 0) {
+        out << "\"\"";
+    }
+    else if (base64_bytes) {
+        static const std::string tag = "base64:";
+        std::string text(1 + tag.length() + util::base64_size(length) + 1, '"');
+        text.replace(1, tag.length(), tag);
+        util::to_base64(data, length, &text[1 + tag.length()]);
+        out << text;
+    }
+    else {
+        std::string hex(2 * length + 2, '"');
+        util::to_hex(data, length, &hex[1]);
+        out << hex;
+    }
+    end_item(omit_newline);
+}
+
+struct json_property_visitor final : public property_visitor
+{
+    json_property_visitor(document_writer &writer, const actor_table &ga, 
+        const actor_table &la) : 
+            w(writer), global_actors(ga), local_actors(la) {}
+
+    // Visit a property through visit_property rather than accept(): the
+    // visitor is final, so the visit() calls are direct.
+    void dispatch(property& prop)
+    {
+        visit_property(prop, [this](auto& p) { visit(&p); });
+    }
+
+    void write_common(property* prop, bool omit_newline = false)
+    {
+        w.write_string("name", prop->name, omit_newline);
+        w.write_string("kind", prop->kind_string(), omit_newline);
+    }
+
+    virtual void visit(int_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_int("value", prop->value, true);
+        w.end_object();
+    }
+
+    virtual void visit(float_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_float("value", prop->value, true);
+        w.end_object();
+    }
+
+    virtual void visit(bool_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_bool("value", prop->value, true);
+        w.end_object();
+    }
+
+    virtual void visit(string_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_unicode_string("value", prop->str);
+        w.end_object();
+    }
+
+    virtual void visit(name_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_string("string", prop->str, true);
+        w.write_int("number", prop->number, true);
+        w.end_object();
+    }
+
+    virtual void visit(object_property *prop) override
+    {
+        w.begin_object(true);
+        write_common(prop, true);
+        w.write_int("actor", prop->actor, true);
+        w.end_object();
+    }
+
+    virtual void visit(enum_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_string("type", prop->type);
+        w.write_string("value", prop->value.name);
+        w.write_int("number", prop->value.number);
+        w.end_object();
+    }
+
+    virtual void visit(struct_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_string("struct_name", prop->struct_name);
+
+        if (prop->native_data_length > 0) {
+            w.write_bytes("native_data", prop->native_data.get(), prop->native_data_length);
+            w.write_key("properties");
+            w.begin_array(true);
+            w.end_array();
+        }
+        else {
+            w.write_bytes("native_data", nullptr, 0);
+            w.write_key("properties");
+            w.begin_array();
+            std::for_each(prop->properties.begin(), prop->properties.end(),
+                [this](const property_ptr& v) {
+                    json_property_visitor visitor(*this);
+                    visitor.dispatch(*v);
+                });
+            w.end_array();
+        }
+        w.end_object();
+    }
+
+    virtual void visit(array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_int("data_length", prop->data_length);
+        w.write_int("array_bound", prop->array_bound);
+        w.write_bytes("data", prop->data.get(), (prop->array_bound > 0) ? prop->data_length : 0);
+        w.end_object();
+    }
+
+    virtual void visit(object_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_key("actors");
+        w.begin_array(true);
+        for (unsigned int i = 0; i < prop->elements.size(); ++i) {
+            w.write_raw_int(prop->elements[i], true);
+        }
+        w.end_array();
+        w.end_object();
+    }
+
+    virtual void visit(number_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_key("elements");
+        w.begin_array(true);
+        for (int32_t v : prop->elements) {
+            w.write_raw_int(v, true);
+        }
+        w.end_array();
+        w.end_object();
+    }
+
+    virtual void visit(string_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_key("strings");
+        w.begin_array();
+        for (const xcom_string& s : prop->elements) {
+            w.write_raw_unicode_string(s);
+        }
+        w.end_array();
+        w.end_object();
+    }
+
+    virtual void visit(enum_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_key("enum_values");
+        w.begin_array();
+        for (const enum_value& s : prop->elements) {
+            w.begin_object(true);
+            w.write_string("value", s.name, true);
+            w.write_int("number", s.number, true);
+            w.end_object();
+        }
+        w.end_array();
+        w.end_object();
+    }
+
+    virtual void visit(struct_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+        w.write_key("structs");
+        w.begin_array();
+        std::for_each(prop->elements.begin(), prop->elements.end(), 
+            [this](const property_list& proplist) {
+                w.begin_array();
+                std::for_each(proplist.begin(), proplist.end(), 
+                    [this](const property_ptr& p) {
+                        dispatch(*p);
+                    });
+                w.end_array();
+            });
+
+        w.end_array();
+        w.end_object();
+    }
+
+    // Return true if we can condense a static array of strings into just a series of string literals in an array instead of having
+    // a big array of nested string properties. This is the case as long as none of the strings in question are wide.
+    // TODO: Probably need to revisit this for non-INT games where it's possibly a lot more likely that all the strings will be UTF-16.
+    bool can_condense_string_array(const static_array_property& static_array)
+    {
+        for (const property_ptr& prop : static_array.properties) {
+            if (property_cast<string_property>(*prop).str.is_wide) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    virtual void visit(static_array_property *prop) override
+    {
+        w.begin_object();
+        write_common(prop);
+
+        // If this array holds well-known subtypes (int), write them right in this node instead of repeating it
+        if (prop->properties.size() > 0 && prop->properties[0]->kind == property::kind_t::int_property) {
+            w.write_key("int_values");
+            w.begin_array(true);
+            for (const property_ptr& v : prop->properties) {
+                w.write_raw_int(property_cast<int_property>(*v).value, true);
+            }
+            w.end_array();
+        }
+        else if (prop->properties.size() > 0 && prop->properties[0]->kind == property::kind_t::string_property && can_condense_string_array(*prop)) {
+            w.write_key("string_values");
+            w.begin_array(true);
+            for (const property_ptr& v : prop->properties) {
+                w.write_raw_string(property_cast<string_property>(*v).str.str, true);
+            }
+            w.end_array();
+        }
+        else {
+            w.write_key("properties");
+            w.begin_array();
+            for (const property_ptr& v : prop->properties) {
+                dispatch(*v);
+            }
+            w.end_array();
+        }
+
+        w.end_object();
+    }
+
+    document_writer& w;
+    const actor_table &global_actors;
+    const actor_table &local_actors;
+};
+
+// Write the members of a checkpoint object.
+static void checkpoint_fields_to_json(const checkpoint & chk, document_writer& w,
+    const actor_table& global_actors, const actor_table& local_actors)
+{
+    // The properties of a lazily read checkpoint aren't in 'properties'
+    // until they're parsed: refuse to write it as an empty list.
+    if (!chk.properties_loaded) {
+        throw error::general_exception("checkpoint " + chk.instance_name +
+            " was read lazily: call load_properties() before writing json");
+    }
+
+    w.write_string("name", chk.name);
+    w.write_string("instance_name", chk.instance_name);
+    w.write_string("class_name", chk.class_name);
+    w.write_key("vector");
+    w.begin_array(true);
+    for (const auto& i : chk.vector) {
+        w.write_raw_float(i, true);
+    }
+    w.end_array();
+    w.write_key("rotator");
+    w.begin_array(true);
+    for (const auto& i : chk.rotator) {
+        w.write_raw_int(i, true);
+    }
+    w.end_array();
+
+    w.write_key("properties");
+    w.begin_array();
+    std::for_each(chk.properties.begin(), chk.properties.end(),
+        [&w, &global_actors, &local_actors](const property_ptr& v) {
+        json_property_visitor visitor{ w, global_actors, local_actors };
+        visitor.dispatch(*v);
+    });
+    w.end_array();
+
+    w.write_int("template_index", chk.template_index);
+    w.write_int("pad_size", chk.pad_size);
+}
+
+static void checkpoint_to_json(const checkpoint & chk, document_writer& w, 
+    const actor_table& global_actors, const actor_table& local_actors)
+{
+    w.begin_object();
+    checkpoint_fields_to_json(chk, w, global_actors, local_actors);
+    w.end_object();
+}
+
+// Write items [0, count) to w in order, as render(i, w) would, on up to
+// 'threads' threads. The first item is written directly. The others are each
+// rendered into their own buffer by a writer that carries on from the state
+// the first left w in, and the buffers are then copied to w in order. So
+// every item must leave the writer in the state it found it in, as array
+// elements (after the first) and ndjson records do.
+static void render_items(json_writer& w, size_t count, unsigned threads,
+    const std::function<void(size_t, json_writer&)>& render)
+{
+    if (count == 0) {
+        return;
+    }
+
+    render(0, w);
+    if (threads == 1 || count == 1) {
+        for (size_t i = 1; i < count; ++i) {
+            render(i, w);
+        }
+        return;
+    }
+
+    json_writer::state item_state = w.get_state();
+    std::vector<std::string> rendered(count - 1);
+    util::parallel_for(count - 1, threads, [&w, &render, &rendered, &item_state](size_t i) {
+        std::ostringstream stream;
+        json_writer item_writer{ stream, item_state, w.is_compact() };
+        item_writer.set_base64_bytes(w.uses_base64_bytes());
+        render(i + 1, item_writer);
+        if (item_writer.get_state() != item_state) {
+            throw xcom::error::general_exception("json item " + std::to_string(i + 1) +
+                " didn't finish where it started");
+        }
+        rendered[i] = stream.str();
+    });
+
+    for (const std::string& text : rendered) {
+        w.write_rendered(text, item_state);
+    }
+}
+
+// Write the members of a checkpoint chunk object. The checkpoint table is
+// filled in by write_checkpoints, or written empty if that's not given.
+static void checkpoint_chunk_fields_to_json(const checkpoint_chunk& chk,
+    document_writer &w, const std::function<void()>& write_checkpoints)
+{
+    w.write_int("unknown_int1", chk.unknown_int1);
+    w.write_string("game_type", chk.game_type);
+    w.write_key("checkpoint_table");
+    w.begin_array();
+    if (write_checkpoints) {
+        write_checkpoints();
+    }
+    w.end_array();
+
+    w.write_int("unknown_int2", chk.unknown_int2);
+    w.write_string("class_name", chk.class_name);
+
+    w.write_key("actor_table");
+    w.begin_array();
+
+    std::for_each(chk.actors.begin(), chk.actors.end(),
+        [&w](const std::string& a) { w.write_raw_string(a); }
+    );
+    w.end_array();
+
+    w.write_int("unknown_int3", chk.unknown_int3);
+    w.write_string("display_name", chk.display_name);
+    w.write_string("map_name", chk.map_name);
+    w.write_int("unknown_int4", chk.unknown_int4);
+}
+
+static void checkpoint_chunk_to_json(const checkpoint_chunk& chk, 
+    document_writer &w, const std::function<void()>& write_checkpoints)
+{
+    w.begin_object();
+    checkpoint_chunk_fields_to_json(chk, w, write_checkpoints);
+    w.end_object();
+}
+
+// Write the members of the header object.
+static void header_fields_to_json(const header& hdr, document_writer& w)
+{
+    w.write_int("version", static_cast<uint32_t>(hdr.version));
+    w.write_int("uncompressed_size", hdr.uncompressed_size);
+    w.write_int("game_number", hdr.game_number);
+    w.write_int("save_number", hdr.save_number);
+    w.write_unicode_string("save_description", hdr.save_description);
+    w.write_unicode_string("time", hdr.time);
+    w.write_string("map_command", hdr.map_command);
+    w.write_bool("tactical_save", hdr.tactical_save);
+    w.write_bool("ironman", hdr.ironman);
+    w.write_bool("autosave", hdr.autosave);
+    w.write_string("dlc", hdr.dlc);
+    w.write_string("language", hdr.language);
+
+    if (hdr.version == xcom_version::enemy_within_android) {
+        w.write_int("profile_number", hdr.profile_number);
+        w.write_unicode_string("profile_date", hdr.profile_date);
+    }
+}
+
+// Write a save as json, with write_checkpoints(chunk) writing the contents
+// of each chunk's checkpoint table.
+static void save_to_json(const saved_game& save, document_writer& w,
+    const std::function<void(const checkpoint_chunk&)>& write_checkpoints)
+{
+    w.begin_object();
+
+    // Write the header
+    w.write_key("header");
+    w.begin_object();
+    header_fields_to_json(save.hdr, w);
+    w.end_object();
+
+    w.write_key("actor_table");
+    w.begin_array();
+    std::for_each(save.actors.begin(), save.actors.end(),
+        [&w](const std::string& a) { w.write_raw_string(a); }
+    );
+    w.end_array();
+
+    w.write_key("checkpoints");
+    w.begin_array();
+    std::for_each(save.checkpoints.begin(), save.checkpoints.end(),
+        [&w, &write_checkpoints](const checkpoint_chunk& v) { 
+            checkpoint_chunk_to_json(v, w, [&write_checkpoints, &v]() { write_checkpoints(v); });
+            w.end_item(false); 
+        });
+    w.end_array();
+    w.end_object();
+}
+
+void buildJson(const saved_game& save, document_writer& w)
+{
+    save_to_json(save, w, [&w, &save](const checkpoint_chunk& chunk) {
+        for (const checkpoint& chk : chunk.checkpoints) {
+            checkpoint_to_json(chk, w, save.actors, chunk.actors);
+        }
+    });
+}
+
+void buildJson(const saved_game& save, json_writer& w, unsigned threads)
+{
+    save_to_json(save, w, [&w, &save, threads](const checkpoint_chunk& chunk) {
+        render_items(w, chunk.checkpoints.size(), threads,
+            [&save, &chunk](size_t i, json_writer& item_writer) {
+                checkpoint_to_json(chunk.checkpoints[i], item_writer, save.actors, chunk.actors);
+            });
+    });
+}
+
+void buildNdjson(const saved_game& save, json_writer& w, unsigned threads)
+{
+    w.begin_object();
+    w.write_string("record", "header");
+    header_fields_to_json(save.hdr, w);
+    w.end_object();
+    w.end_record();
+
+    for (size_t i = 0; i < save.actors.size(); ++i) {
+        w.begin_object();
+        w.write_string("record", "actor");
+        w.write_int("index", static_cast<int32_t>(i));
+        w.write_string("name", save.actors[i]);
+        w.end_object();
+        w.end_record();
+    }
+
+    for (size_t c = 0; c < save.checkpoints.size(); ++c) {
+        const checkpoint_chunk& chunk = save.checkpoints[c];
+        w.begin_object();
+        w.write_string("record", "chunk");
+        w.write_int("chunk", static_cast<int32_t>(c));
+        checkpoint_chunk_fields_to_json(chunk, w, nullptr);
+        w.end_object();
+        w.end_record();
+
+        render_items(w, chunk.checkpoints.size(), threads,
+            [&save, &chunk, c](size_t i, json_writer& record_writer) {
+                record_writer.begin_object();
+                record_writer.write_string("record", "checkpoint");
+                record_writer.write_int("chunk", static_cast<int32_t>(c));
+                record_writer.write_int("index", static_cast<int32_t>(i));
+                checkpoint_fields_to_json(chunk.checkpoints[i], record_writer, save.actors, chunk.actors);
+                record_writer.end_object();
+                record_writer.end_record();
+            });
+    }
+}
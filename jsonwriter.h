@@ -1,10 +1,322 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
 #ifndef JSONWRITER_H
 #define JSONWRITER_H
 
 #include "xcom.h"
-#include "json11.hpp"
 
-using namespace json11;
+#include <fstream>
+#include <ostream>
+#include <string>
+
+std::string json_escape(const std::string& str);
+
+// Receives a save from buildJson(). The structure is the same whichever
+// encoding the writer produces.
+struct document_writer
+{
+    virtual ~document_writer() = default;
+
+    virtual void begin_object(bool omit_newline = false) = 0;
+    virtual void end_object() = 0;
+    virtual void begin_array(bool omit_newline = false) = 0;
+    virtual void end_array() = 0;
+    virtual void end_item(bool omit_newline) = 0;
+    virtual void write_key(const std::string &name) = 0;
+    virtual void write_int(const std::string &name, int32_t val, bool omit_newline = false) = 0;
+    virtual void write_raw_int(int val, bool omit_newline = false) = 0;
+    virtual void write_float(const std::string &name, float val, bool omit_newline = false) = 0;
+    virtual void write_raw_float(float val, bool omit_newline = false) = 0;
+    virtual void write_string(const std::string &name, const std::string &val,
+            bool omit_newline = false) = 0;
+    virtual void write_unicode_string(const std::string& name, const xcom::xcom_string& str) = 0;
+    virtual void write_raw_unicode_string(const xcom::xcom_string& str) = 0;
+    virtual void write_raw_string(const std::string& val, bool omit_newline = false) = 0;
+    virtual void write_bool(const std::string &name, bool val, bool omit_newline = false) = 0;
+
+    // Raw bytes: native struct data and the contents of unknown arrays.
+    virtual void write_bytes(const std::string &name, const unsigned char *data, size_t length,
+            bool omit_newline = false) = 0;
+};
+
+struct json_writer : document_writer
+{
+    // A compact writer puts everything on one line, with no indentation.
+    json_writer(const std::string& filename, bool compact_output = false) :
+        file(filename), out(file), indent_level(0), skip_indent(true), needs_comma(false),
+        compact(compact_output)
+    {
+        out.setf(std::ofstream::boolalpha);
+    }
+
+    json_writer(std::ostream& stream, bool compact_output = false) :
+        out(stream), indent_level(0), skip_indent(true), needs_comma(false),
+        compact(compact_output)
+    {
+        out.setf(std::ofstream::boolalpha);
+    }
+
+    // Where a writer is in the document: enough for another writer to carry
+    // on from the same place.
+    struct state
+    {
+        size_t indent_level;
+        bool skip_indent;
+        bool needs_comma;
+
+        bool operator==(const state& other) const
+        {
+            return indent_level == other.indent_level && skip_indent == other.skip_indent &&
+                needs_comma == other.needs_comma;
+        }
+
+        bool operator!=(const state& other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    // A writer that writes to stream as if continuing from s, e.g. to render
+    // part of a document into its own buffer. See write_rendered().
+    json_writer(std::ostream& stream, const state& s, bool compact_output = false) :
+        out(stream), indent_level(s.indent_level), skip_indent(s.skip_indent),
+        needs_comma(s.needs_comma), compact(compact_output)
+    {
+        out.setf(std::ofstream::boolalpha);
+    }
+
+    state get_state() const
+    {
+        return { indent_level, skip_indent, needs_comma };
+    }
+
+    bool is_compact() const
+    {
+        return compact;
+    }
+
+    // Write bytes as base64 rather than hex. The text is a third shorter,
+    // and is tagged so that build_save() can tell which it is.
+    void set_base64_bytes(bool enable)
+    {
+        base64_bytes = enable;
+    }
+
+    bool uses_base64_bytes() const
+    {
+        return base64_bytes;
+    }
+
+    // Copy text rendered by a writer that continued from this one's state,
+    // leaving this writer in the state that writer finished in.
+    void write_rendered(const std::string& text, const state& s)
+    {
+        out.write(text.data(), static_cast<std::streamsize>(text.length()));
+        indent_level = s.indent_level;
+        skip_indent = s.skip_indent;
+        needs_comma = s.needs_comma;
+    }
+
+    void indent()
+    {
+        if (needs_comma) {
+            out << ", ";
+
+        }
+        if (!skip_indent && !compact) {
+            out << '\n';
+            std::string ind(2 * indent_level, ' ');
+            out << ind;
+        }
+    }
+
+    void begin_object(bool omit_newline = false) override
+    {
+        indent();
+        out << "{ ";
+        ++indent_level;
+        needs_comma = false;
+        skip_indent = omit_newline;
+    }
+
+    void end_object() override
+    {
+        --indent_level;
+        if (needs_comma) {
+            out << " ";
+        }
+        needs_comma = false;
+        indent();
+        out << "}";
+        needs_comma = true;
+        skip_indent = false;
+    }
+
+    void begin_array(bool omit_newline = false) override
+    {
+        indent();
+        out << "[ ";
+        ++indent_level;
+        needs_comma = false;
+        skip_indent = omit_newline;
+    }
+
+    void end_array() override
+    {
+        --indent_level;
+        if (needs_comma) {
+            out << " ";
+        }
+        needs_comma = false;
+        indent();
+        out << "]";
+        needs_comma = true;
+        skip_indent = false;
+    }
+
+    void end_item(bool omit_newline) override
+    {
+        if (!omit_newline) {
+            skip_indent = false;
+        }
+        else {
+            skip_indent = true;
+        }
+
+        needs_comma = true;
+    }
+
+    void write_key(const std::string &name) override
+    {
+        indent();
+        out << "\"" << name << "\": ";
+        skip_indent = true;
+        needs_comma = false;
+    }
+
+    void write_int(const std::string &name, int32_t val, bool omit_newline = false) override
+    {
+        write_key(name);
+        out << val;
+        end_item(omit_newline);
+    }
+
+    void write_raw_int(int val, bool omit_newline = false) override
+    {
+        indent();
+        out << val;
+        end_item(omit_newline);
+    }
+
+    void write_float(const std::string &name, float val, bool omit_newline = false) override
+    {
+        write_key(name);
+        out << (val + 0.0f);
+        end_item(omit_newline);
+    }
+
+    void write_raw_float(float val, bool omit_newline = false) override
+    {
+        indent();
+        out << val;
+        end_item(omit_newline);
+    }
+
+    void write_string(const std::string &name, const std::string &val, 
+            bool omit_newline = false) override
+    {
+        write_key(name);
+        out << "\"" << json_escape(val) << "\"";
+        end_item(omit_newline);
+    }
+
+    void write_unicode_string(const std::string& name, const xcom::xcom_string& str) override
+    {
+        write_key(name);
+        begin_object(true);
+        write_string("str", str.str, true);
+        write_bool("is_wide", str.is_wide, true);
+        end_object();
+    }
+
+    void write_raw_unicode_string(const xcom::xcom_string& str) override
+    {
+        begin_object(true);
+        write_string("str", str.str, true);
+        write_bool("is_wide", str.is_wide, true);
+        end_object();
+    }
+
+    void write_raw_string(const std::string& val, bool omit_newline = false) override
+    {
+        indent();
+        out << "\"" << json_escape(val) << "\"";
+        end_item(omit_newline);
+    }
+
+    void write_bool(const std::string &name, bool val, bool omit_newline = false) override
+    {
+        write_key(name);
+        out << val;
+        end_item(omit_newline);
+    }
+
+    // End a top-level value and start a new line for the next one.
+    void end_record()
+    {
+        out << '\n';
+        needs_comma = false;
+        skip_indent = true;
+    }
+
+    // Bytes are written as a hex string, or as base64 prefixed with
+    // "base64:" if set_base64_bytes() asked for that.
+    void write_bytes(const std::string &name, const unsigned char *data, size_t length,
+            bool omit_newline = false) override;
+
+private:
+    std::ofstream file;
+    std::ostream& out;
+    size_t indent_level;
+    bool skip_indent;
+    bool needs_comma;
+    bool compact;
+    bool base64_bytes = false;
+};
+
+// Write a save as json in the format read back by build_save(). A save read
+// with read_options::lazy_properties needs xcom::load_properties() first;
+// any checkpoint whose properties haven't been parsed is an error.
+void buildJson(const xcom::saved_game& save, document_writer& w);
+
+// As above, rendering the checkpoints of each chunk on up to 'threads'
+// threads (0 for one per core). The output is the same.
+void buildJson(const xcom::saved_game& save, json_writer& w, unsigned threads);
+
+// Write a save as newline-delimited json: one compact object per line for
+// the header, each global actor, each checkpoint chunk (with an empty
+// checkpoint table) and each checkpoint. Each line has a "record" member
+// naming its type. Chunk and checkpoint lines carry the index of their
+// chunk, and actor and checkpoint lines their index within their table.
+// Use a compact writer. Checkpoint records are rendered on up to 'threads'
+// threads (0 for one per core).
+void buildNdjson(const xcom::saved_game& save, json_writer& w, unsigned threads = 1);
 
-Json buildJson(const XComSave& save);
-#endif //JSONWRITER_H
+#endif // JSONWRITER_H
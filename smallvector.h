@@ -0,0 +1,206 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef SMALLVECTOR_H
+#define SMALLVECTOR_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace xcom
+{
+    // A vector that holds up to N elements inline and only allocates when it
+    // grows past them. Elements must be trivially copyable: they're moved
+    // around with memcpy. The interface is the subset of std::vector the
+    // library uses, and it converts from and to std::vector.
+    template <typename T, size_t N>
+    class small_vector
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "small_vector elements must be trivially copyable");
+
+    public:
+        using value_type = T;
+        using size_type = size_t;
+        using reference = T&;
+        using const_reference = const T&;
+        using iterator = T*;
+        using const_iterator = const T*;
+
+        small_vector() = default;
+
+        explicit small_vector(size_t count, const T& value = T())
+        {
+            resize(count, value);
+        }
+
+        small_vector(std::initializer_list<T> init)
+        {
+            assign(init.begin(), init.size());
+        }
+
+        small_vector(const std::vector<T>& v)
+        {
+            assign(v.data(), v.size());
+        }
+
+        small_vector(const small_vector& other)
+        {
+            assign(other.data(), other.size());
+        }
+
+        small_vector(small_vector&& other) noexcept
+        {
+            take(other);
+        }
+
+        small_vector& operator=(const small_vector& other)
+        {
+            if (this != &other) {
+                clear();
+                assign(other.data(), other.size());
+            }
+            return *this;
+        }
+
+        small_vector& operator=(small_vector&& other) noexcept
+        {
+            if (this != &other) {
+                heap_.reset();
+                take(other);
+            }
+            return *this;
+        }
+
+        operator std::vector<T>() const
+        {
+            return std::vector<T>(begin(), end());
+        }
+
+        T *data() { return heap_ ? heap_.get() : inline_; }
+        const T *data() const { return heap_ ? heap_.get() : inline_; }
+        size_t size() const { return size_; }
+        size_t capacity() const { return capacity_; }
+        bool empty() const { return size_ == 0; }
+
+        // True while the elements are held inline.
+        bool is_inline() const { return heap_ == nullptr; }
+
+        T& operator[](size_t i) { assert(i < size_); return data()[i]; }
+        const T& operator[](size_t i) const { assert(i < size_); return data()[i]; }
+        T& front() { return (*this)[0]; }
+        const T& front() const { return (*this)[0]; }
+        T& back() { return (*this)[size_ - 1]; }
+        const T& back() const { return (*this)[size_ - 1]; }
+
+        iterator begin() { return data(); }
+        iterator end() { return data() + size_; }
+        const_iterator begin() const { return data(); }
+        const_iterator end() const { return data() + size_; }
+
+        void reserve(size_t count)
+        {
+            if (count <= capacity_) {
+                return;
+            }
+            std::unique_ptr<T[]> grown{ new T[count] };
+            memcpy(grown.get(), data(), size_ * sizeof(T));
+            heap_ = std::move(grown);
+            capacity_ = count;
+        }
+
+        void resize(size_t count, const T& value = T())
+        {
+            reserve(count);
+            std::fill(data() + std::min(size_, count), data() + count, value);
+            size_ = count;
+        }
+
+        void push_back(const T& value)
+        {
+            if (size_ == capacity_) {
+                // Copy first: value may be one of our elements.
+                T copy = value;
+                reserve(capacity_ * 2);
+                data()[size_++] = copy;
+            }
+            else {
+                data()[size_++] = value;
+            }
+        }
+
+        void pop_back()
+        {
+            assert(size_ > 0);
+            --size_;
+        }
+
+        void clear()
+        {
+            size_ = 0;
+        }
+
+        bool operator==(const small_vector& other) const
+        {
+            return std::equal(begin(), end(), other.begin(), other.end());
+        }
+
+        bool operator!=(const small_vector& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        void assign(const T *values, size_t count)
+        {
+            reserve(count);
+            if (count > 0) {
+                memcpy(data(), values, count * sizeof(T));
+            }
+            size_ = count;
+        }
+
+        void take(small_vector& other)
+        {
+            if (other.heap_) {
+                heap_ = std::move(other.heap_);
+                capacity_ = other.capacity_;
+            }
+            else {
+                memcpy(inline_, other.inline_, other.size_ * sizeof(T));
+                capacity_ = N;
+            }
+            size_ = other.size_;
+            other.size_ = 0;
+            other.capacity_ = N;
+        }
+
+        std::unique_ptr<T[]> heap_;
+        size_t size_ = 0;
+        size_t capacity_ = N;
+        T inline_[N];
+    };
+}
+
+#endif // SMALLVECTOR_H
@@ -24,9 +24,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <cassert>
 #include <sstream>
 #include <stdarg.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 
 #ifdef _MSC_VER
 #include <windows.h>
+#include <intrin.h>
 #else
 #include <iconv.h>
 #endif
@@ -105,68 +113,30 @@ namespace xcom
             return ~crc;
         }
 
-        static char to_hex_nibble(unsigned char nib)
+        bool have_avx2()
         {
-            return nib < 10 ? nib + '0' : nib - 10 + 'a';
-        }
-
-        static unsigned char from_hex_nibble(char c)
-        {
-            switch (c)
-            {
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-                return c - '0';
-            case 'a':
-            case 'b':
-            case 'c':
-            case 'd':
-            case 'e':
-            case 'f':
-                return c - 'a' + 10;
-            case 'A':
-            case 'B':
-            case 'C':
-            case 'D':
-            case 'E':
-            case 'F':
-                return c - 'F' + 10;
-            }
-
-            std::string str = "unexpected hex character: ";
-            str.append(1, c);
-            throw xcom::error::general_exception(str);
-        }
-
-        std::string to_hex(const unsigned char *data, size_t length)
-        {
-            std::string str;
-            for (size_t i = 0; i < length; ++i) {
-                str += to_hex_nibble(data[i] >> 4);
-                str += to_hex_nibble(data[i] & 0x0F);
-            }
-
-            return str;
-        }
-
-        std::unique_ptr<unsigned char[]> from_hex(const std::string &str)
-        {
-            std::unique_ptr<unsigned char[]> data = 
-                std::make_unique<unsigned char[]>(str.length() / 2);
-            for (size_t i = 0; i < str.length(); i += 2) {
-                data[i / 2] = from_hex_nibble(str[i]) << 4;
-                data[i / 2] |= from_hex_nibble(str[i + 1]);
-            }
-
-            return data;
+#if defined(__x86_64__) || defined(_M_X64)
+            static const bool avx2 = []() {
+#ifdef _MSC_VER
+                int regs[4];
+                __cpuid(regs, 0);
+                if (regs[0] < 7) {
+                    return false;
+                }
+                // The processor has to support AVX2 and the OS has to save
+                // the AVX registers.
+                __cpuid(regs, 1);
+                bool osxsave = (regs[2] & (1 << 27)) != 0;
+                __cpuidex(regs, 7, 0);
+                return osxsave && (regs[1] & (1 << 5)) != 0 && (_xgetbv(0) & 6) == 6;
+#else
+                return __builtin_cpu_supports("avx2") != 0;
+#endif
+            }();
+            return avx2;
+#else
+            return false;
+#endif
         }
 
         std::string iso8859_1_to_utf8(const std::string& in)
@@ -228,9 +198,42 @@ namespace xcom
             return std::string{ buf.get() };
         }
 #else
+        // A conversion descriptor that is opened on first use and reused by
+        // later conversions on the same thread.
+        class iconv_descriptor
+        {
+        public:
+            iconv_descriptor(const char *to, const char *from) :
+                cd_{ iconv_open(to, from) } {}
+
+            ~iconv_descriptor()
+            {
+                if (cd_ != reinterpret_cast<iconv_t>(-1)) {
+                    iconv_close(cd_);
+                }
+            }
+
+            iconv_descriptor(const iconv_descriptor&) = delete;
+            iconv_descriptor& operator=(const iconv_descriptor&) = delete;
+
+            // Get the descriptor, reset to its initial state.
+            iconv_t get()
+            {
+                if (cd_ == reinterpret_cast<iconv_t>(-1)) {
+                    throw xcom::error::general_exception("failed to open character set conversion");
+                }
+                iconv(cd_, nullptr, nullptr, nullptr, nullptr);
+                return cd_;
+            }
+
+        private:
+            iconv_t cd_;
+        };
+
         std::u16string utf8_to_utf16(const std::string& in)
         {
-            iconv_t cd = iconv_open("UTF-16LE", "UTF-8");
+            static thread_local iconv_descriptor descriptor{ "UTF-16LE", "UTF-8" };
+            iconv_t cd = descriptor.get();
             const char *in_buf = in.c_str();
             std::size_t in_length = in.length();
             std::size_t out_length = in.length() * 2 + 1;
@@ -248,7 +251,8 @@ namespace xcom
 
         std::string utf16_to_utf8(const std::u16string& in)
         {
-            iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
+            static thread_local iconv_descriptor descriptor{ "UTF-8", "UTF-16LE" };
+            iconv_t cd = descriptor.get();
             const char *in_buf = reinterpret_cast<const char *>(in.c_str());
             std::size_t in_length = in.length() * sizeof(char16_t);
             std::size_t out_length = in.length() * 4 + 1;
@@ -264,6 +268,57 @@ namespace xcom
         }
 #endif
 
+        void parallel_for(size_t count, unsigned threads, const std::function<void(size_t)>& body)
+        {
+            if (threads == 0) {
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            }
+            threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+            std::atomic<size_t> next{ 0 };
+            std::vector<std::exception_ptr> errors(threads);
+
+            // Each worker takes the next unclaimed item until there are none
+            // left, so a worker that gets cheap items just does more of them.
+            // After a failure a worker stops, but only for items after the
+            // failed one: an earlier failure elsewhere must still be found.
+            auto worker = [&](unsigned w) {
+                size_t failed_at = count;
+                for (size_t i = next++; i < count; i = next++) {
+                    if (i > failed_at) {
+                        continue;
+                    }
+                    try {
+                        body(i);
+                    }
+                    catch (...) {
+                        if (i < failed_at) {
+                            failed_at = i;
+                            errors[w] = std::current_exception();
+                        }
+                    }
+                }
+                return failed_at;
+            };
+
+            std::vector<size_t> failed_at(threads, count);
+            std::vector<std::thread> pool;
+            for (unsigned w = 1; w < threads; ++w) {
+                pool.emplace_back([&, w]() { failed_at[w] = worker(w); });
+            }
+            if (threads > 0) {
+                failed_at[0] = worker(0);
+            }
+            for (std::thread& t : pool) {
+                t.join();
+            }
+
+            size_t first = std::min_element(failed_at.begin(), failed_at.end()) - failed_at.begin();
+            if (threads > 0 && failed_at[first] < count) {
+                std::rethrow_exception(errors[first]);
+            }
+        }
+
     } // namespace util
 
     int32_t property::full_size() const
@@ -393,40 +448,105 @@ namespace xcom
     }
 
 
-    std::string build_actor_name(const std::string& package, const std::string& cls, int instance)
+    void actor_table::add(const std::string& package, const std::string& class_name, int32_t instance)
+    {
+        entries_.push_back({ intern(package), intern(class_name), instance });
+    }
+
+    void actor_table::add(const std::string& class_name, int32_t instance)
+    {
+        entries_.push_back({ actor_entry::no_package, intern(class_name), instance });
+    }
+
+    void actor_table::push_back(const std::string& name)
+    {
+        size_t dot = name.find_first_of('.');
+        size_t underscore = name.find_last_of('_');
+
+        if (underscore == std::string::npos || (dot != std::string::npos && underscore < dot)) {
+            throw error::general_exception("Malformed actor name: " + name);
+        }
+
+        const char *number = name.c_str() + underscore + 1;
+        char *end;
+        errno = 0;
+        long n = strtol(number, &end, 10);
+        if (end == number || *end != '\0' || errno == ERANGE || n < INT32_MIN || n >= INT32_MAX) {
+            throw error::general_exception("Malformed actor name: " + name);
+        }
+
+        int32_t instance = static_cast<int32_t>(n) + 1;
+        if (dot == std::string::npos) {
+            add(name.substr(0, underscore), instance);
+        }
+        else {
+            add(name.substr(0, dot), name.substr(dot + 1, underscore - dot - 1), instance);
+        }
+    }
+
+    void actor_table::clear()
+    {
+        entries_.clear();
+        strings_.clear();
+        string_ids_.clear();
+    }
+
+    const std::string& actor_table::package(size_t i) const
     {
-        std::stringstream ret;
-        ret << package << "." << cls << "_" << (instance - 1);
-        return ret.str();
+        static const std::string none;
+        return has_package(i) ? strings_[entries_[i].package] : none;
     }
-    
-    std::string build_actor_name_EU(const std::string& cls, int instance)
+
+    std::string actor_table::name(size_t i) const
     {
-        std::stringstream ret;
-        ret << cls << "_" << (instance - 1);
-        return ret.str();
+        std::string ret;
+        append_name(i, ret);
+        return ret;
     }
-    
-    std::tuple<std::string, std::string, int> decompose_actor_name(const std::string& actorName)
+
+    void actor_table::append_name(size_t i, std::string& out) const
     {
-        size_t underscore;
-        size_t dot;
+        const actor_entry& e = entries_[i];
+        char number[16];
+        int length = snprintf(number, sizeof number, "%d", e.instance - 1);
+        const std::string& cls = strings_[e.class_name];
+
+        if (e.package != actor_entry::no_package) {
+            const std::string& package = strings_[e.package];
+            out.reserve(out.length() + package.length() + cls.length() + length + 2);
+            out.append(package).append(1, '.');
+        }
+        else {
+            out.reserve(out.length() + cls.length() + length + 1);
+        }
+        out.append(cls).append(1, '_').append(number, length);
+    }
 
-        dot = actorName.find_first_of('.');
-        underscore = actorName.find_last_of('_');
+    bool actor_table::operator==(const actor_table& other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
 
-        std::string package = actorName.substr(0, dot);
-        std::string cls = actorName.substr(dot + 1, underscore - dot - 1);
-        int instance = std::stoi(actorName.substr(underscore + 1));
-        return std::make_tuple(package, cls, instance + 1);
+        for (size_t i = 0; i < size(); ++i) {
+            if (has_package(i) != other.has_package(i) || instance(i) != other.instance(i) ||
+                package(i) != other.package(i) || class_name(i) != other.class_name(i)) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    std::tuple<std::string, int> decompose_actor_name_EU(const std::string& actorName)
+    uint32_t actor_table::intern(const std::string& str)
     {
-        size_t underscore = actorName.find_last_of('_');
+        auto it = string_ids_.find(str);
+        if (it != string_ids_.end()) {
+            return it->second;
+        }
 
-        std::string cls = actorName.substr(0, underscore);
-        int instance = std::stoi(actorName.substr(underscore + 1) );
-        return std::make_tuple(cls, instance + 1);
+        uint32_t id = static_cast<uint32_t>(strings_.size());
+        strings_.push_back(str);
+        string_ids_.emplace(str, id);
+        return id;
     }
 }
@@ -19,6 +19,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <functional>
 #include <memory>
 
 #ifdef _DEBUG
@@ -42,14 +43,47 @@ namespace xcom
         std::u16string utf8_to_utf16(const std::string& in);
         std::string utf16_to_utf8(const std::u16string& in);
 
+        // Hex encoding of raw data, in lower case. See hex.cpp.
         std::string to_hex(const unsigned char *data, size_t dataLen);
         std::unique_ptr<unsigned char[]> from_hex(const std::string& str);
+
+        // Write the hex digits of length bytes to out, which must have room
+        // for 2 * length characters. No terminating null is written.
+        void to_hex(const unsigned char *data, size_t length, char *out);
+
+        // Decode length characters of hex, in either case, to out, which must
+        // have room for length / 2 bytes. Throws on an odd length or an
+        // invalid character, giving its offset.
+        void from_hex(const char *str, size_t length, unsigned char *out);
+
+        // Base64 encoding of raw data, with padding. See base64.cpp.
+        size_t base64_size(size_t length);
+        void to_base64(const unsigned char *data, size_t length, char *out);
+        std::string to_base64(const unsigned char *data, size_t length);
+
+        // The number of bytes some base64 text decodes to. Throws if its
+        // length isn't a multiple of 4.
+        size_t from_base64_size(const char *str, size_t length);
+
+        // Decode base64 text to out, which must have room for
+        // from_base64_size() bytes. Throws on an invalid character, giving
+        // its offset.
+        void from_base64(const char *str, size_t length, unsigned char *out);
+        std::unique_ptr<unsigned char[]> from_base64(const std::string& str, size_t& length);
+
+        // Does the processor support AVX2 (and the OS save its registers)?
+        // Always false other than on x86-64.
+        bool have_avx2();
+
+        // Call body(i) for each i in [0, count) on up to 'threads' threads
+        // (0 for one per core), including the calling thread. Items are
+        // handed out one at a time, so it doesn't matter if some take much
+        // longer than others. If any call throws, the exception thrown for
+        // the lowest i is rethrown once all threads are done, which is the
+        // exception a serial loop would have stopped at.
+        void parallel_for(size_t count, unsigned threads, const std::function<void(size_t)>& body);
     }
 
-    std::string build_actor_name(const std::string& package, const std::string& cls, int instance);
-    std::string build_actor_name_EU(const std::string& cls, int instance);
-    std::tuple<std::string, std::string, int> decompose_actor_name(const std::string& actorName);
-    std::tuple<std::string, int> decompose_actor_name_EU(const std::string& actorName);
     std::string property_kind_to_string(property::kind_t kind);
 }
 #endif // UTIL_H
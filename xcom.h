@@ -27,6 +27,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <memory>
 #include <algorithm>
 #include <exception>
+#include <iterator>
+#include <unordered_map>
+#include <cassert>
+
+#include "smallvector.h"
 
 namespace xcom
 {
@@ -99,17 +104,17 @@ namespace xcom
     struct header
     {
         // XCom save version
-        xcom_version version;
+        xcom_version version = xcom_version::invalid;
 
         // From the upk packages this looks like it should be the total
         // uncompressed size of the save data. In practice It's always all zeros.
-        int32_t uncompressed_size;
+        int32_t uncompressed_size = 0;
 
         // The game number
-        int32_t game_number;
+        int32_t game_number = 0;
 
         // The save number
-        int32_t save_number;
+        int32_t save_number = 0;
 
         // The readable save description. This appears in the load game list.
         xcom_string save_description;
@@ -121,13 +126,13 @@ namespace xcom
         std::string map_command;
 
         // True if this is a tactical mission save, false if it's a geoscape save
-        bool tactical_save;
+        bool tactical_save = false;
 
         // True if the game is an ironman game
-        bool ironman;
+        bool ironman = false;
 
         // True if this is an autosave
-        bool autosave;
+        bool autosave = false;
 
         // A string containing the names of all installed DLC packs
         std::string dlc;
@@ -135,11 +140,114 @@ namespace xcom
         // The current game language (e.g. INT for English/International)
         std::string language;
 
-        int32_t profile_number; // Profile number (Android)
+        int32_t profile_number = 0; // Profile number (Android)
         xcom_string profile_date; // Profile date? (Android)
     };
 
-    using actor_table = std::vector<std::string>;
+    // An actor in an actor table. The save stores an actor as its class and
+    // instance number and, in EW, the package (map) it belongs to, and the
+    // entry keeps it in those parts. The package and class are ids of
+    // strings interned in the table.
+    struct actor_entry
+    {
+        // The package id, or no_package for an EU actor.
+        uint32_t package;
+        uint32_t class_name;
+
+        // The instance number as stored in the save: one more than the
+        // number in the actor's name.
+        int32_t instance;
+
+        static constexpr uint32_t no_package = 0xffffffff;
+    };
+
+    // A table of actors. Object properties refer to actors by their index in
+    // the save's global actor table or their chunk's local one.
+    //
+    // Actors are named <package>.<class>_<n> in EW (e.g.
+    // Command1.XGStrategySoldier_3) and <class>_<n> in EU. Names are only
+    // rendered when asked for. The table stores each actor's parts, so
+    // reading and writing a save needs no formatting or parsing.
+    class actor_table
+    {
+    public:
+        class const_iterator;
+
+        // Add an EW actor from its parts, as stored in the save.
+        void add(const std::string& package, const std::string& class_name, int32_t instance);
+
+        // Add an EU actor, which has no package.
+        void add(const std::string& class_name, int32_t instance);
+
+        // Add an actor by its name, e.g. one read from json. Throws
+        // general_exception if the name isn't of the form above.
+        void push_back(const std::string& name);
+
+        size_t size() const { return entries_.size(); }
+        bool empty() const { return entries_.empty(); }
+        void reserve(size_t count) { entries_.reserve(count); }
+        void clear();
+
+        const actor_entry& entry(size_t i) const { return entries_[i]; }
+        bool has_package(size_t i) const { return entries_[i].package != actor_entry::no_package; }
+        const std::string& package(size_t i) const;
+        const std::string& class_name(size_t i) const { return strings_[entries_[i].class_name]; }
+        int32_t instance(size_t i) const { return entries_[i].instance; }
+
+        // The name of an actor.
+        std::string name(size_t i) const;
+        std::string operator[](size_t i) const { return name(i); }
+
+        // Append the name of an actor to out, e.g. to build lookup keys in a
+        // reused buffer.
+        void append_name(size_t i, std::string& out) const;
+
+        // Iterates over the actors' names.
+        const_iterator begin() const;
+        const_iterator end() const;
+
+        bool operator==(const actor_table& other) const;
+        bool operator!=(const actor_table& other) const { return !(*this == other); }
+
+    private:
+        uint32_t intern(const std::string& str);
+
+        std::vector<actor_entry> entries_;
+        std::vector<std::string> strings_;
+        std::unordered_map<std::string, uint32_t> string_ids_;
+    };
+
+    class actor_table::const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = std::string;
+
+        const_iterator(const actor_table& table, size_t index) : table_(&table), index_(index) {}
+
+        std::string operator*() const { return table_->name(index_); }
+        const_iterator& operator++() { ++index_; return *this; }
+        const_iterator operator++(int) { const_iterator it = *this; ++index_; return it; }
+        bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+    private:
+        const actor_table *table_;
+        size_t index_;
+    };
+
+    inline actor_table::const_iterator actor_table::begin() const
+    {
+        return { *this, 0 };
+    }
+
+    inline actor_table::const_iterator actor_table::end() const
+    {
+        return { *this, entries_.size() };
+    }
 
     struct property_visitor;
 
@@ -201,7 +309,9 @@ namespace xcom
         std::string kind_string() const;
         virtual int32_t size() const = 0;
         virtual int32_t full_size() const;
-        virtual void accept(property_visitor * v) = 0;
+
+        // Call v->visit() for the property's type. See also visit_property().
+        void accept(property_visitor * v);
 
         std::string name;
         kind_t kind;
@@ -256,9 +366,16 @@ namespace xcom
         virtual void visit(static_array_property*) = 0;
     };
 
-    // A list of properties.
+    // A list of properties. This is the one in-memory form of a property
+    // tree: the reader, writer, json code and editors all work on it. Saves
+    // that are loaded repeatedly can be cached as a snapshot (see
+    // xcomsnapshot.h), which stores the tree as flat records.
     using property_list = std::vector<property_ptr>;
 
+    // The elements of an object or number array. Most arrays in a save hold
+    // only a few elements, so short ones are stored inline.
+    using array_elements = small_vector<int32_t, 8>;
+
 
     // An object property refers to an actor.
     struct object_property : public property
@@ -270,10 +387,6 @@ namespace xcom
             return 8;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         int32_t actor;
     };
     
@@ -298,10 +411,6 @@ namespace xcom
             return 4;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         int32_t value;
     };
 
@@ -321,10 +430,6 @@ namespace xcom
             return property::full_size() + 1;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         bool value;
     };
 
@@ -338,10 +443,6 @@ namespace xcom
             return 4;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         float value;
     };
 
@@ -362,10 +463,6 @@ namespace xcom
 
         virtual int32_t size() const;
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         xcom_string str;
     };
 
@@ -380,10 +477,6 @@ namespace xcom
         name_property(const std::string& n, const std::string& s, int32_t d) :
             property(n, kind_t::name_property), str(s), number(d) {}
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         virtual int32_t size() const {
             // Length of the string + null byte + the string size integer + the
             // number value.
@@ -423,10 +516,6 @@ namespace xcom
             return 4 + data_length;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::unique_ptr<unsigned char[]> data;
         int32_t array_bound;
         int32_t data_length;
@@ -436,18 +525,14 @@ namespace xcom
     // in the actor table.
     struct object_array_property : public property
     {
-        object_array_property(const std::string& n, std::vector<int32_t>&& objs) :
+        object_array_property(const std::string& n, array_elements&& objs) :
             property(n, kind_t::object_array_property), elements(std::move(objs)) {}
 
         virtual int32_t size() const {
             return 4 + 8 * static_cast<int32_t>(elements.size());
         }
 
-        virtual void accept(property_visitor* v) {
-            v->visit(this);
-        }
-
-        std::vector<int32_t> elements;
+        array_elements elements;
     };
 
     // A number array property. This can be either an array of ints or an array
@@ -457,18 +542,14 @@ namespace xcom
     // values.
     struct number_array_property : public property
     {
-        number_array_property(const std::string& n, std::vector<int32_t> && objs) :
+        number_array_property(const std::string& n, array_elements&& objs) :
             property(n, kind_t::number_array_property), elements(std::move(objs)) {}
 
         virtual int32_t size() const {
             return 4 + 4 * static_cast<int32_t>(elements.size());
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
-        std::vector<int32_t> elements;
+        array_elements elements;
     };
 
     // A struct array property. Each element is a struct instance and all
@@ -500,10 +581,6 @@ namespace xcom
             return total;
         }
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::vector<property_list> elements;
     };
 
@@ -517,10 +594,6 @@ namespace xcom
 
         virtual int32_t size() const;
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::vector<xcom_string> elements;
     };
 
@@ -534,10 +607,6 @@ namespace xcom
 
         virtual int32_t size() const;
 
-        virtual void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::vector<enum_value> elements;
     };
 
@@ -569,10 +638,6 @@ namespace xcom
             return property::full_size() + static_cast<int32_t>(type.length()) + 5 + 4;
         }
 
-        void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::string type;
         enum_value value;
     };
@@ -599,10 +664,6 @@ namespace xcom
         virtual int32_t size() const;
         virtual int32_t full_size() const;
 
-        void accept(property_visitor *v) {
-            v->visit(this);
-        }
-
         std::string struct_name;
         property_list properties;
         std::unique_ptr<unsigned char[]> native_data;
@@ -637,11 +698,57 @@ namespace xcom
             return total;
         }
 
-        void accept(property_visitor *v) {
-            v->visit(this);
+        property_list properties;
+    };
+
+    // The location of one compressed chunk in a save file. The body of the
+    // save is split into chunks of at most 128KiB which are compressed
+    // independently, each preceded by a 24 byte chunk header.
+    struct compressed_chunk
+    {
+        // The offset of the chunk header in the save file
+        size_t compressed_offset;
+
+        // The size of the compressed data following the chunk header
+        int32_t compressed_size;
+
+        // The offset of the chunk's data in the decompressed body
+        size_t uncompressed_offset;
+
+        // The size of the chunk's data once decompressed
+        int32_t uncompressed_size;
+    };
+
+    // The decompressed body of a save that was read from disk. Saves read
+    // with read_options::lazy_properties or retain_source keep this alive so
+    // that checkpoints can parse their properties on demand, and so that
+    // unmodified checkpoints and chunks can be written back by copying their
+    // original bytes.
+    struct save_source
+    {
+        xcom_version version;
+        buffer<unsigned char> data;
+
+        // The save file the data was decompressed from, and the location of
+        // each compressed chunk in it.
+        buffer<unsigned char> compressed;
+        std::vector<compressed_chunk> chunks;
+    };
+
+    // A range of bytes within a save_source.
+    struct source_span
+    {
+        std::shared_ptr<const save_source> source;
+        size_t offset = 0;
+        size_t length = 0;
+
+        bool empty() const {
+            return source == nullptr;
         }
 
-        property_list properties;
+        const unsigned char *data() const {
+            return source->data.buf.get() + offset;
+        }
     };
 
     // A 3-d vector.
@@ -679,6 +786,35 @@ namespace xcom
 
         // The number of padding bytes (all zeros) appended to the checkpoint.
         uint32_t pad_size;
+
+        // For a checkpoint read with read_options::lazy_properties or
+        // retain_source, the serialized property list (including any
+        // padding) in the decompressed save. Empty for checkpoints built by
+        // hand.
+        source_span property_data;
+
+        // False for a lazily read checkpoint whose properties have not been
+        // parsed yet. Until they are, 'properties' is empty and 'pad_size' is
+        // unknown.
+        bool properties_loaded = true;
+
+        // Set when the checkpoint has been modified since it was read. A
+        // checkpoint with property_data that is not dirty is written by
+        // copying its original property bytes, so anything that changes
+        // 'properties' must either go through edit_properties() or set this.
+        // Changes to the other fields are found when writing without it.
+        bool dirty = false;
+
+        // Return the property list, parsing it from property_data first if
+        // this checkpoint was read lazily and hasn't been accessed yet. The
+        // first call on a lazy checkpoint modifies it, so it must not be made
+        // from two threads at once for the same checkpoint; different
+        // checkpoints may be loaded concurrently.
+        property_list& get_properties();
+
+        // As get_properties(), but also marks the checkpoint dirty so the
+        // changes are written out.
+        property_list& edit_properties();
     };
 
     using checkpoint_table = std::vector<checkpoint>;
@@ -740,10 +876,25 @@ namespace xcom
 
         // Unknown.
         int32_t unknown_int4;
+
+        // For a chunk read with read_options::lazy_properties or
+        // retain_source, the entire serialized chunk in the decompressed
+        // save.
+        source_span data;
+
+        // Set to force the chunk to be written field by field. A chunk with
+        // data that is not dirty and whose checkpoints are all clean is
+        // written by copying its original bytes, but only after checking
+        // that its fields, actor table and checkpoint list, and its
+        // checkpoints' names, positions and classes, still match them. So
+        // changing any of those doesn't need this set.
+        bool dirty = false;
     };
 
     using checkpoint_chunk_table = std::vector<checkpoint_chunk>;
 
+    class checkpoint_index;
+
     // An xcom save. The save consists of three main parts:
     // 1) The header. This part is always uncompressed (parts 2 and 3 are
     //    stored compressed in the file) and contains basic information about
@@ -773,12 +924,66 @@ namespace xcom
         header hdr;
         actor_table actors;
         checkpoint_chunk_table checkpoints;
+
+        // The save this one was read from, if it was read with
+        // retain_source or lazy_properties. When writing, compressed chunks
+        // whose data hasn't changed are copied from it rather than being
+        // compressed again.
+        std::shared_ptr<const save_source> source;
+
+        // Lookup of checkpoints by name, class and actor, if the save was
+        // read with read_options::index_checkpoints. See xcomindex.h.
+        std::shared_ptr<checkpoint_index> index;
+    };
+
+    // Options controlling how a save is read.
+    struct read_options
+    {
+        // Record the span of each checkpoint's properties instead of parsing
+        // them. They are parsed on first access through
+        // checkpoint::get_properties(), and checkpoints that are never
+        // accessed are written back by copying their original bytes. Useful
+        // for tools that only look at a handful of checkpoints.
+        bool lazy_properties = false;
+
+        // Keep the decompressed save data so that checkpoints and chunks
+        // that have not been marked dirty are written back by copying their
+        // original bytes instead of re-serializing them, and compressed
+        // chunks whose data is unchanged are not recompressed. Implied by
+        // lazy_properties.
+        bool retain_source = false;
+
+        // Build saved_game::index once the save has been read.
+        bool index_checkpoints = false;
+
+        // The number of threads to parse checkpoint properties on, or 0 for
+        // one per core. With more than one, the checkpoints are found first
+        // and their properties are then parsed in parallel. Ignored with
+        // lazy_properties.
+        unsigned threads = 1;
+    };
+
+    saved_game read_xcom_save(const std::string &infile, const read_options &options = {});
+    saved_game read_xcom_save(buffer<unsigned char>&& buf, const read_options &options = {});
+
+    // Parse the properties of every checkpoint of a lazily read save that
+    // hasn't been accessed yet, on up to 'threads' threads (0 for one per
+    // core). Needed before handing the save to code that reads
+    // checkpoint::properties directly, such as the json writers.
+    void load_properties(saved_game& save, unsigned threads = 1);
+
+    // Options controlling how a save is written.
+    struct write_options
+    {
+        // The number of threads to encode checkpoints on, or 0 for one per
+        // core. With more than one, the size of each checkpoint is computed
+        // up front and the checkpoints are then written in parallel into
+        // their place in the output.
+        unsigned threads = 1;
     };
 
-    saved_game read_xcom_save(const std::string &infile);
-    saved_game read_xcom_save(buffer<unsigned char>&& buf);
-    void write_xcom_save(const saved_game &save, const std::string &outfile);
-    buffer<unsigned char> write_xcom_save(const saved_game &save);
+    void write_xcom_save(const saved_game &save, const std::string &outfile, const write_options &options = {});
+    buffer<unsigned char> write_xcom_save(const saved_game &save, const write_options &options = {});
 
     // Errors
     namespace error {
@@ -829,5 +1034,91 @@ namespace xcom
             char buf_[1024];
         };
     }
+
+    // The kind of each property type.
+    template <typename T> struct property_kind_of;
+    template <> struct property_kind_of<int_property> { static constexpr property::kind_t value = property::kind_t::int_property; };
+    template <> struct property_kind_of<float_property> { static constexpr property::kind_t value = property::kind_t::float_property; };
+    template <> struct property_kind_of<bool_property> { static constexpr property::kind_t value = property::kind_t::bool_property; };
+    template <> struct property_kind_of<string_property> { static constexpr property::kind_t value = property::kind_t::string_property; };
+    template <> struct property_kind_of<object_property> { static constexpr property::kind_t value = property::kind_t::object_property; };
+    template <> struct property_kind_of<name_property> { static constexpr property::kind_t value = property::kind_t::name_property; };
+    template <> struct property_kind_of<enum_property> { static constexpr property::kind_t value = property::kind_t::enum_property; };
+    template <> struct property_kind_of<struct_property> { static constexpr property::kind_t value = property::kind_t::struct_property; };
+    template <> struct property_kind_of<array_property> { static constexpr property::kind_t value = property::kind_t::array_property; };
+    template <> struct property_kind_of<object_array_property> { static constexpr property::kind_t value = property::kind_t::object_array_property; };
+    template <> struct property_kind_of<number_array_property> { static constexpr property::kind_t value = property::kind_t::number_array_property; };
+    template <> struct property_kind_of<struct_array_property> { static constexpr property::kind_t value = property::kind_t::struct_array_property; };
+    template <> struct property_kind_of<string_array_property> { static constexpr property::kind_t value = property::kind_t::string_array_property; };
+    template <> struct property_kind_of<enum_array_property> { static constexpr property::kind_t value = property::kind_t::enum_array_property; };
+    template <> struct property_kind_of<static_array_property> { static constexpr property::kind_t value = property::kind_t::static_array_property; };
+
+    // Downcast a property to the type of its kind, which it must have.
+    template <typename T>
+    T& property_cast(property& prop)
+    {
+        assert(prop.kind == property_kind_of<T>::value);
+        return static_cast<T&>(prop);
+    }
+
+    template <typename T>
+    const T& property_cast(const property& prop)
+    {
+        assert(prop.kind == property_kind_of<T>::value);
+        return static_cast<const T&>(prop);
+    }
+
+    namespace detail
+    {
+        template <typename P, typename F>
+        decltype(auto) visit_property(P& prop, F&& f)
+        {
+            using kind_t = property::kind_t;
+            switch (prop.kind)
+            {
+            case kind_t::int_property: return f(property_cast<int_property>(prop));
+            case kind_t::float_property: return f(property_cast<float_property>(prop));
+            case kind_t::bool_property: return f(property_cast<bool_property>(prop));
+            case kind_t::string_property: return f(property_cast<string_property>(prop));
+            case kind_t::object_property: return f(property_cast<object_property>(prop));
+            case kind_t::name_property: return f(property_cast<name_property>(prop));
+            case kind_t::enum_property: return f(property_cast<enum_property>(prop));
+            case kind_t::struct_property: return f(property_cast<struct_property>(prop));
+            case kind_t::array_property: return f(property_cast<array_property>(prop));
+            case kind_t::object_array_property: return f(property_cast<object_array_property>(prop));
+            case kind_t::number_array_property: return f(property_cast<number_array_property>(prop));
+            case kind_t::struct_array_property: return f(property_cast<struct_array_property>(prop));
+            case kind_t::string_array_property: return f(property_cast<string_array_property>(prop));
+            case kind_t::enum_array_property: return f(property_cast<enum_array_property>(prop));
+            case kind_t::static_array_property: return f(property_cast<static_array_property>(prop));
+            default:
+                throw error::general_exception("unknown property kind " + std::to_string(static_cast<int>(prop.kind)));
+            }
+        }
+    }
+
+    // Call f with the property as the type of its kind, e.g. f(int_property&)
+    // for an int property, and return what it returns. f must take every
+    // property type: a generic lambda, or a visitor-like object with an
+    // operator() for each. The type is picked with a switch on the kind, so
+    // there are no virtual calls or RTTI, and f's calls can be inlined. This
+    // is the fast path for walking properties; accept() and property_visitor
+    // are built on it.
+    template <typename F>
+    decltype(auto) visit_property(property& prop, F&& f)
+    {
+        return detail::visit_property(prop, std::forward<F>(f));
+    }
+
+    template <typename F>
+    decltype(auto) visit_property(const property& prop, F&& f)
+    {
+        return detail::visit_property(prop, std::forward<F>(f));
+    }
+
+    inline void property::accept(property_visitor *v)
+    {
+        visit_property(*this, [v](auto& p) { v->visit(&p); });
+    }
 } // namespace xcom
 #endif // XCOM_H
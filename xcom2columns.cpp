@@ -0,0 +1,209 @@
+
+#include "xcom.h"
+#include "xcomcolumns.h"
+#include "util.h"
+#include "batch.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <locale>
+
+#if __has_include(<filesystem>)
+#include <filesystem>
+namespace fs = std::filesystem;
+#elif __has_include(<experimental/filesystem>)
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#else
+#error No <filesystem> support on this platform.
+#endif
+
+using namespace xcom;
+
+void usage(const char * name)
+{
+    printf("Usage: %s [-j <threads>] -o <out_file> <in_file|directory|@list_file> ...\n", name);
+    printf("       %s [-c <column>,...] -t <column_file>\n", name);
+    printf("-o -- Write the properties of all the input saves to this column file\n");
+    printf("-j -- Number of saves to read at once, defaults to one per core\n");
+    printf("-t -- Print a column file as tab-separated text\n");
+    printf("-c -- With -t, print only these columns: save, checkpoint, path, kind, int, float, string\n");
+}
+
+static const char *column_names[column_format::column_count] = {
+    "save", "checkpoint", "path", "kind", "int", "float", "string"
+};
+
+// Parse a comma-separated list of column names into a set of column bits.
+// Returns 0 if a name isn't recognized.
+static uint32_t parse_columns(const std::string& list)
+{
+    uint32_t columns = 0;
+    size_t start = 0;
+    for (;;) {
+        size_t comma = list.find(',', start);
+        std::string name = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        bool found = false;
+        for (uint32_t id = 0; id < column_format::column_count; ++id) {
+            if (name == column_names[id]) {
+                columns |= column_format::column_bit(static_cast<column_format::column_id>(id));
+                found = true;
+            }
+        }
+        if (!found) {
+            return 0;
+        }
+        if (comma == std::string::npos) {
+            return columns;
+        }
+        start = comma + 1;
+    }
+}
+
+// Print each row as the selected columns, in the order save, checkpoint,
+// path, kind, int, float and string. Only those columns are read.
+static void print_columns(const std::string& infile, uint32_t columns)
+{
+    column_reader reader{ infile, columns };
+    property_rows rows;
+    while (reader.next(rows)) {
+        for (size_t i = 0; i < rows.size(); ++i) {
+            char float_value[32];
+            snprintf(float_value, sizeof float_value, "%g", rows.float_value[i]);
+            const std::string fields[column_format::column_count] = {
+                rows.save_id[i],
+                rows.checkpoint[i],
+                rows.path[i],
+                property_kind_to_string(static_cast<property::kind_t>(rows.kind[i])),
+                std::to_string(rows.int_value[i]),
+                float_value,
+                rows.string_value[i]
+            };
+
+            std::string line;
+            bool first = true;
+            for (uint32_t id = 0; id < column_format::column_count; ++id) {
+                if ((columns & column_format::column_bit(static_cast<column_format::column_id>(id))) != 0) {
+                    line += (first ? "" : "\t") + fields[id];
+                    first = false;
+                }
+            }
+            printf("%s\n", line.c_str());
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> inputs;
+    std::string outfile;
+    std::string textfile;
+    uint32_t columns = column_format::all_columns;
+    unsigned threads = 0;
+
+    if (argc <= 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setlocale(LC_ALL, "en_US.utf8");
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-t") == 0 ||
+                strcmp(argv[i], "-c") == 0) {
+            if (argc <= (i+1)) {
+                usage(argv[0]);
+                return 1;
+            }
+            char option = argv[i][1];
+            const char *value = argv[++i];
+            if (option == 'o') {
+                outfile = value;
+            }
+            else if (option == 't') {
+                textfile = value;
+            }
+            else if (option == 'c') {
+                columns = parse_columns(value);
+                if (columns == 0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+            }
+            else {
+                threads = static_cast<unsigned>(atoi(value));
+            }
+        }
+        else {
+            inputs.push_back(argv[i]);
+        }
+    }
+
+    try {
+        if (!textfile.empty()) {
+            if (!inputs.empty() || !outfile.empty()) {
+                usage(argv[0]);
+                return 1;
+            }
+            print_columns(textfile, columns);
+            return 0;
+        }
+
+        if (inputs.empty() || outfile.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        // Pick up save files from directories, skipping anything we wrote.
+        std::vector<std::string> files = expand_batch_inputs(inputs,
+            [](const std::string& name) {
+                fs::path extension = fs::path(name).extension();
+                return extension != ".json" && extension != ".cbor" && extension != ".ndjson" &&
+                    extension != ".xcc";
+            });
+
+        std::vector<batch_job> jobs;
+        for (const std::string& file : files) {
+            jobs.push_back({ file, outfile });
+        }
+
+        // Each save becomes one row group, numbered by its place in the
+        // input so the file comes out in the same order however the jobs
+        // finish. Saves are read lazily so each checkpoint's properties are
+        // only held while they're flattened.
+        read_options options;
+        options.lazy_properties = true;
+
+        column_writer writer{ outfile };
+        size_t failed = run_batch(jobs, threads,
+            [&writer, &options, &jobs](const batch_job& job) {
+                size_t group = &job - jobs.data();
+                try {
+                    saved_game save = read_xcom_save(job.infile, options);
+                    property_rows rows;
+                    flatten_properties(job.infile, save, rows);
+                    writer.write(group, rows);
+                }
+                catch (...) {
+                    writer.skip(group);
+                    throw;
+                }
+            });
+        writer.close();
+
+        if (failed > 0) {
+            fprintf(stderr, "%zu of %zu files failed to convert.\n", failed, jobs.size());
+            return 1;
+        }
+        return 0;
+    }
+    catch (const error::xcom_exception& e) {
+        fprintf(stderr, "%s", e.what().c_str());
+        return 1;
+    }
+    catch (const fs::filesystem_error& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
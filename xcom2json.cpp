@@ -1,6 +1,9 @@
 
 #include "xcom.h"
-#include "util.h"
+#include "jsonwriter.h"
+#include "cbor.h"
+#include "xcomsnapshot.h"
+#include "batch.h"
 
 #include <string>
 #include <iostream>
@@ -10,572 +13,96 @@
 #include <cstring>
 #include <locale>
 #include <cassert>
+#include <vector>
+
+#if __has_include(<filesystem>)
+#include <filesystem>
+namespace fs = std::filesystem;
+#elif __has_include(<experimental/filesystem>)
+#include <experimental/filesystem>
+namespace fs = std::experimental::filesystem;
+#else
+#error No <filesystem> support on this platform.
+#endif
 
 using namespace xcom;
 
-static std::string escape(const std::string& str) {
-    std::string ret;
-
-    for (size_t i = 0; i < str.length(); ++i) {
-        switch (str[i])
-        {
-        case '"':
-            ret += "\\\"";
-            break;
-        case '\\':
-            ret += "\\\\";
-            break;
-        case '\n':
-            ret += "\\n";
-            break;
-        case '\r':
-            ret += "\\r";
-            break;
-        case '\t':
-            ret += "\\t";
-            break;
-        default:
-            if (str[i] > 0 && str[i] < ' ') {
-                std::string hex = 
-                    util::to_hex(reinterpret_cast<const unsigned char *>(&str[i]), 1);
-                ret += "\\u00";
-                ret += hex;
-            }
-            else {
-                ret += str[i];
-            }
-        }
-    }
-
-    return ret;
+void usage(const char * name)
+{
+    printf("Usage: %s [-c|-n|-s] [-b] [-o <out_file>] <in_file>\n", name);
+    printf("       %s [-c|-n|-s] [-b] [-d <out_dir>] [-j <threads>] <in_file|directory|@list_file> ...\n", name);
+    printf("-c -- Write CBOR instead of json text\n");
+    printf("-n -- Write newline-delimited json, one line per checkpoint\n");
+    printf("-s -- Write a snapshot of the parsed save, which later runs reload without parsing\n");
+    printf("-b -- Write raw data as base64 instead of hex (not with -c or -s)\n");
+    printf("-o -- Specify output file name, defaults to <in_file>.json, .cbor, .ndjson or .xcss\n");
+    printf("-d -- Write batch output files into this directory instead of next to their inputs\n");
+    printf("-j -- Number of files to convert at once in a batch, defaults to one per core\n");
+    printf("Inputs may be saves or snapshots.\n");
 }
 
-struct json_writer
+enum class output_format
 {
-    json_writer(const std::string& filename) :
-        out(filename), indent_level(0), skip_indent(true), needs_comma(false)
-    {
-        out.setf(std::ofstream::boolalpha);
-    }
-
-    void indent()
-    {
-        if (needs_comma) {
-            out << ", ";
-
-        }
-        if (!skip_indent) {
-            out << std::endl;
-            std::string ind(2 * indent_level, ' ');
-            out << ind;
-        }
-    }
-
-    void begin_object(bool omit_newline = false)
-    {
-        indent();
-        out << "{ ";
-        ++indent_level;
-        needs_comma = false;
-        skip_indent = omit_newline;
-    }
-
-    void end_object()
-    {
-        --indent_level;
-        if (needs_comma) {
-            out << " ";
-        }
-        needs_comma = false;
-        indent();
-        out << "}";
-        needs_comma = true;
-        skip_indent = false;
-    }
-
-    void begin_array(bool omit_newline = false)
-    {
-        indent();
-        out << "[ ";
-        ++indent_level;
-        needs_comma = false;
-        skip_indent = omit_newline;
-    }
-
-    void end_array()
-    {
-        --indent_level;
-        if (needs_comma) {
-            out << " ";
-        }
-        needs_comma = false;
-        indent();
-        out << "]";
-        needs_comma = true;
-        skip_indent = false;
-    }
-
-    void end_item(bool omit_newline)
-    {
-        if (!omit_newline) {
-            skip_indent = false;
-        }
-        else {
-            skip_indent = true;
-        }
-
-        needs_comma = true;
-    }
-
-    void write_key(const std::string &name)
-    {
-        indent();
-        out << "\"" << name << "\": ";
-        skip_indent = true;
-        needs_comma = false;
-    }
-
-    void write_int(const std::string &name, int32_t val, bool omit_newline = false)
-    {
-        write_key(name);
-        out << val;
-        end_item(omit_newline);
-    }
-
-    void write_raw_int(int val, bool omit_newline = false)
-    {
-        indent();
-        out << val;
-        end_item(omit_newline);
-    }
-
-    void write_float(const std::string &name, float val, bool omit_newline = false)
-    {
-        write_key(name);
-        out << (val + 0.0f);
-        end_item(omit_newline);
-    }
-
-    void write_raw_float(float val, bool omit_newline = false)
-    {
-        indent();
-        out << val;
-        end_item(omit_newline);
-    }
-
-    void write_string(const std::string &name, const std::string &val, 
-            bool omit_newline = false)
-    {
-        write_key(name);
-        out << "\"" << escape(val) << "\"";
-        end_item(omit_newline);
-    }
-
-    void write_unicode_string(const std::string& name, const xcom_string& str)
-    {
-        write_key(name);
-        begin_object(true);
-        write_string("str", str.str, true);
-        write_bool("is_wide", str.is_wide, true);
-        end_object();
-    }
-
-    void write_raw_unicode_string(const xcom_string& str)
-    {
-        begin_object(true);
-        write_string("str", str.str, true);
-        write_bool("is_wide", str.is_wide, true);
-        end_object();
-    }
-
-    void write_raw_string(const std::string& val, bool omit_newline = false)
-    {
-        indent();
-        out << "\"" << escape(val) << "\"";
-        end_item(omit_newline);
-    }
-
-    void write_bool(const std::string &name, bool val, bool omit_newline = false)
-    {
-        write_key(name);
-        out << val;
-        end_item(omit_newline);
-    }
-
-
-private:
-    std::ofstream out;
-    size_t indent_level;
-    bool skip_indent;
-    bool needs_comma;
+    json,
+    cbor,
+    ndjson,
+    snapshot
 };
 
-
-
-struct json_property_visitor : public property_visitor
+static std::string output_file_name(const std::string& infile, const std::string& outdir, output_format format)
 {
-    json_property_visitor(json_writer &writer, const actor_table &ga, 
-        const actor_table &la) : 
-            w(writer), global_actors(ga), local_actors(la) {}
-
-    void write_common(property* prop, bool omit_newline = false)
-    {
-        w.write_string("name", prop->name, omit_newline);
-        w.write_string("kind", prop->kind_string(), omit_newline);
-    }
-
-    virtual void visit(int_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_int("value", prop->value, true);
-        w.end_object();
-    }
-
-    virtual void visit(float_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_float("value", prop->value, true);
-        w.end_object();
+    const char *extension = (format == output_format::cbor) ? ".cbor" :
+        (format == output_format::ndjson) ? ".ndjson" :
+        (format == output_format::snapshot) ? ".xcss" : ".json";
+    if (outdir.empty()) {
+        return infile + extension;
     }
-
-    virtual void visit(bool_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_bool("value", prop->value, true);
-        w.end_object();
-    }
-
-    virtual void visit(string_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_unicode_string("value", prop->str);
-        w.end_object();
-    }
-
-    virtual void visit(name_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_string("string", prop->str, true);
-        w.write_int("number", prop->number, true);
-        w.end_object();
-    }
-
-    virtual void visit(object_property *prop) override
-    {
-        w.begin_object(true);
-        write_common(prop, true);
-        w.write_int("actor", prop->actor, true);
-        w.end_object();
-    }
-
-    virtual void visit(enum_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_string("type", prop->type);
-        w.write_string("value", prop->value.name);
-        w.write_int("number", prop->value.number);
-        w.end_object();
-    }
-
-    virtual void visit(struct_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_string("struct_name", prop->struct_name);
-
-        if (prop->native_data_length > 0) {
-            w.write_string("native_data", 
-                util::to_hex(prop->native_data.get(), prop->native_data_length));
-            w.write_key("properties");
-            w.begin_array(true);
-            w.end_array();
-        }
-        else {
-            w.write_string("native_data", "");
-            w.write_key("properties");
-            w.begin_array();
-            std::for_each(prop->properties.begin(), prop->properties.end(),
-                [this](const property_ptr& v) {
-                    json_property_visitor visitor(*this);
-                    v->accept(&visitor);
-                });
-            w.end_array();
-        }
-        w.end_object();
-    }
-
-    virtual void visit(array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_int("data_length", prop->data_length);
-        w.write_int("array_bound", prop->array_bound);
-        std::string data_str = (prop->array_bound > 0) ? 
-            util::to_hex(prop->data.get(), prop->data_length) : "";
-        w.write_string("data", data_str);
-        w.end_object();
-    }
-
-    virtual void visit(object_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_key("actors");
-        w.begin_array(true);
-        for (unsigned int i = 0; i < prop->elements.size(); ++i) {
-            w.write_raw_int(prop->elements[i], true);
-        }
-        w.end_array();
-        w.end_object();
-    }
-
-    virtual void visit(number_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_key("elements");
-        w.begin_array(true);
-        for (int32_t v : prop->elements) {
-            w.write_raw_int(v, true);
-        }
-        w.end_array();
-        w.end_object();
-    }
-
-    virtual void visit(string_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_key("strings");
-        w.begin_array();
-        for (const xcom_string& s : prop->elements) {
-            w.write_raw_unicode_string(s);
-        }
-        w.end_array();
-        w.end_object();
-    }
-
-    virtual void visit(enum_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_key("enum_values");
-        w.begin_array();
-        for (const enum_value& s : prop->elements) {
-            w.begin_object(true);
-            w.write_string("value", s.name, true);
-            w.write_int("number", s.number, true);
-            w.end_object();
-        }
-        w.end_array();
-        w.end_object();
-    }
-
-    virtual void visit(struct_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-        w.write_key("structs");
-        w.begin_array();
-        std::for_each(prop->elements.begin(), prop->elements.end(), 
-            [this](const property_list& proplist) {
-                w.begin_array();
-                std::for_each(proplist.begin(), proplist.end(), 
-                    [this](const property_ptr& p) {
-                        p->accept(this);
-                    });
-                w.end_array();
-            });
-
-        w.end_array();
-        w.end_object();
-    }
-
-    // Return true if we can condense a static array of strings into just a series of string literals in an array instead of having
-    // a big array of nested string properties. This is the case as long as none of the strings in question are wide.
-    // TODO: Probably need to revisit this for non-INT games where it's possibly a lot more likely that all the strings will be UTF-16.
-    bool can_condense_string_array(const static_array_property& static_array)
-    {
-        for (const property_ptr& prop : static_array.properties) {
-            const string_property *string_prop = dynamic_cast<const string_property*>(prop.get());
-            assert(string_prop != nullptr);
-            if (string_prop->str.is_wide) {
-                return false;
-            }
-        }
-        return true;
-    }
-
-    virtual void visit(static_array_property *prop) override
-    {
-        w.begin_object();
-        write_common(prop);
-
-        // If this array holds well-known subtypes (int), write them right in this node instead of repeating it
-        if (prop->properties.size() > 0 && prop->properties[0]->kind == property::kind_t::int_property) {
-            w.write_key("int_values");
-            w.begin_array(true);
-            for (const property_ptr& v : prop->properties) {
-                const int_property *int_prop = dynamic_cast<const int_property*>(v.get());
-                w.write_raw_int(int_prop->value, true);
-            }
-            w.end_array();
-        }
-        else if (prop->properties.size() > 0 && prop->properties[0]->kind == property::kind_t::string_property && can_condense_string_array(*prop)) {
-            w.write_key("string_values");
-            w.begin_array(true);
-            for (const property_ptr& v : prop->properties) {
-                const string_property *string_prop = dynamic_cast<const string_property*>(v.get());
-                w.write_raw_string(string_prop->str.str, true);
-            }
-            w.end_array();
-        }
-        else {
-            w.write_key("properties");
-            w.begin_array();
-            for (const property_ptr& v : prop->properties) {
-                v->accept(this);
-            }
-            w.end_array();
-        }
-
-        w.end_object();
-    }
-
-    json_writer& w;
-    const actor_table &global_actors;
-    const actor_table &local_actors;
-};
-
-static void checkpoint_to_json(const checkpoint & chk, json_writer& w, 
-    const actor_table& global_actors, const actor_table& local_actors)
-{
-    w.begin_object();
-    w.write_string("name", chk.name);
-    w.write_string("instance_name", chk.instance_name);
-    w.write_string("class_name", chk.class_name);
-    w.write_key("vector");
-    w.begin_array(true);
-    for (const auto& i : chk.vector) {
-        w.write_raw_float(i, true);
-    }
-    w.end_array();
-    w.write_key("rotator");
-    w.begin_array(true);
-    for (const auto& i : chk.rotator) {
-        w.write_raw_int(i, true);
-    }
-    w.end_array();
-
-    w.write_key("properties");
-    w.begin_array();
-    std::for_each(chk.properties.begin(), chk.properties.end(),
-        [&w, &global_actors, &local_actors](const property_ptr& v) {
-        json_property_visitor visitor{ w, global_actors, local_actors };
-        v->accept(&visitor);
-    });
-    w.end_array();
-
-    w.write_int("template_index", chk.template_index);
-    w.write_int("pad_size", chk.pad_size);
-    w.end_object();
+    return (fs::path(outdir) / fs::path(infile).filename()).string() + extension;
 }
 
-static void checkpoint_chunk_to_json(const checkpoint_chunk& chk, 
-    json_writer &w, const saved_game& save)
+static saved_game load(const std::string& infile, unsigned threads)
 {
-    w.begin_object();
-    w.write_int("unknown_int1", chk.unknown_int1);
-    w.write_string("game_type", chk.game_type);
-    w.write_key("checkpoint_table");
-    w.begin_array();
-    std::for_each(chk.checkpoints.begin(), chk.checkpoints.end(),
-        [&w, &save, &chk](const checkpoint& v) { 
-            checkpoint_to_json(v, w, save.actors, chk.actors); 
-        });
-    w.end_array();
-
-    w.write_int("unknown_int2", chk.unknown_int2);
-    w.write_string("class_name", chk.class_name);
-
-    w.write_key("actor_table");
-    w.begin_array();
-
-    std::for_each(chk.actors.begin(), chk.actors.end(),
-        [&w](const std::string& a) { w.write_raw_string(a); }
-    );
-    w.end_array();
-
-    w.write_int("unknown_int3", chk.unknown_int3);
-    w.write_string("display_name", chk.display_name);
-    w.write_string("map_name", chk.map_name);
-    w.write_int("unknown_int4", chk.unknown_int4);
-    w.end_object();
-}
-
-void buildJson(const saved_game& save, json_writer& w)
-{
-    w.begin_object();
-
-    // Write the header
-    const header &hdr = save.hdr;
-
-    w.write_key("header");
-    w.begin_object();
-    w.write_int("version", static_cast<uint32_t>(hdr.version));
-    w.write_int("uncompressed_size", hdr.uncompressed_size);
-    w.write_int("game_number", hdr.game_number);
-    w.write_int("save_number", hdr.save_number);
-    w.write_unicode_string("save_description", hdr.save_description);
-    w.write_unicode_string("time", hdr.time);
-    w.write_string("map_command", hdr.map_command);
-    w.write_bool("tactical_save", hdr.tactical_save);
-    w.write_bool("ironman", hdr.ironman);
-    w.write_bool("autosave", hdr.autosave);
-    w.write_string("dlc", hdr.dlc);
-    w.write_string("language", hdr.language);
-
-    if (hdr.version == xcom_version::enemy_within_android) {
-        w.write_int("profile_number", hdr.profile_number);
-        w.write_unicode_string("profile_date", hdr.profile_date);
+    // A snapshot reloads without decompressing or parsing the save.
+    if (is_snapshot(infile)) {
+        return snapshot{ infile }.load();
     }
-    w.end_object();
 
-    w.write_key("actor_table");
-    w.begin_array();
-    std::for_each(save.actors.begin(), save.actors.end(),
-        [&w](const std::string& a) { w.write_raw_string(a); }
-    );
-    w.end_array();
-
-    w.write_key("checkpoints");
-    w.begin_array();
-    std::for_each(save.checkpoints.begin(), save.checkpoints.end(),
-        [&w, &save](const checkpoint_chunk& v) { 
-            checkpoint_chunk_to_json(v, w, save); w.end_item(false); 
-        });
-    w.end_array();
-    w.end_object();
+    read_options options;
+    options.threads = threads;
+    return read_xcom_save(infile, options);
 }
 
-void usage(const char * name)
+static void convert(const std::string& infile, const std::string& outfile, output_format format,
+    bool base64, unsigned threads)
 {
-    printf("Usage: %s [-o <out_file>] <in_file>\n", name);
-    printf("-o -- Specify output file name, defaults to <in_file>.json\n");
+    saved_game save = load(infile, threads);
+    if (format == output_format::snapshot) {
+        write_snapshot(save, outfile);
+    }
+    else if (format == output_format::cbor) {
+        cbor_writer w{ outfile };
+        buildJson(save, w);
+    }
+    else if (format == output_format::ndjson) {
+        json_writer w{ outfile, true };
+        w.set_base64_bytes(base64);
+        buildNdjson(save, w, threads);
+    }
+    else {
+        json_writer w{ outfile };
+        w.set_base64_bytes(base64);
+        buildJson(save, w, threads);
+    }
 }
 
-
 int main(int argc, char *argv[])
 {
-    std::string infile;
+    std::vector<std::string> inputs;
     std::string outfile;
-    std::string tmpfile;
+    std::string outdir;
+    unsigned threads = 0;
+    output_format format = output_format::json;
+    bool base64 = false;
 
     if (argc <= 1) {
         usage(argv[0]);
@@ -585,43 +112,111 @@ int main(int argc, char *argv[])
     setlocale(LC_ALL, "en_US.utf8");
 
     for (int i = 1; i < argc; ++i) {
-        if (strcmp(argv[i], "-o") == 0) {
-            if (argc <= (i+1)) {
+        if (strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-s") == 0) {
+            output_format selected = (argv[i][1] == 'c') ? output_format::cbor :
+                (argv[i][1] == 'n') ? output_format::ndjson : output_format::snapshot;
+            if (format != output_format::json && format != selected) {
                 usage(argv[0]);
                 return 1;
             }
-            outfile = argv[++i];
+            format = selected;
         }
-        else {
-            if (!infile.empty()) {
+        else if (strcmp(argv[i], "-b") == 0) {
+            base64 = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "-j") == 0) {
+            if (argc <= (i+1)) {
                 usage(argv[0]);
                 return 1;
             }
-
-            infile = argv[i];
+            char option = argv[i][1];
+            const char *value = argv[++i];
+            if (option == 'o') {
+                outfile = value;
+            }
+            else if (option == 'd') {
+                outdir = value;
+            }
+            else {
+                threads = static_cast<unsigned>(atoi(value));
+            }
+        }
+        else {
+            inputs.push_back(argv[i]);
         }
     }
 
-    if (infile.empty()) {
+    // CBOR and snapshots store bytes as they are.
+    if (inputs.empty() || (base64 && (format == output_format::cbor || format == output_format::snapshot))) {
         usage(argv[0]);
         return 1;
     }
 
-    if (outfile.empty()) {
-        outfile = infile + ".json";
+    std::error_code ec;
+    bool batch = inputs.size() > 1 || !outdir.empty() || inputs[0][0] == '@' || fs::is_directory(inputs[0], ec);
+
+    if (!batch) {
+        if (outfile.empty()) {
+            outfile = output_file_name(inputs[0], outdir, format);
+        }
+
+        try {
+            // A single save is parsed on every core.
+            convert(inputs[0], outfile, format, base64, 0);
+            return 0;
+        }
+        catch (const error::xcom_exception& e) {
+            fprintf(stderr, "%s", e.what().c_str());
+            return 1;
+        }
+
+        fprintf(stderr, "Error: unknown error.\n");
+        return 1;
+    }
+
+    // An output file name only makes sense for a single input.
+    if (!outfile.empty()) {
+        usage(argv[0]);
+        return 1;
     }
 
     try {
-        saved_game save = read_xcom_save(infile);
-        json_writer w{ outfile };
-        buildJson(save, w);
+        if (!outdir.empty()) {
+            fs::create_directories(outdir);
+        }
+
+        // Pick up save files from directories, skipping any json in there.
+        // Snapshots are inputs too, unless they're what's being written.
+        std::vector<std::string> files = expand_batch_inputs(inputs,
+            [format](const std::string& name) {
+                fs::path extension = fs::path(name).extension();
+                return extension != ".json" && extension != ".cbor" && extension != ".ndjson" &&
+                    (extension != ".xcss" || format != output_format::snapshot);
+            });
+
+        std::vector<batch_job> jobs;
+        for (const std::string& file : files) {
+            jobs.push_back({ file, output_file_name(file, outdir, format) });
+        }
+
+        // Inputs with the same name from different directories can't share
+        // an output directory.
+        check_batch_outputs(jobs);
+
+        size_t failed = run_batch(jobs, threads,
+            [format, base64](const batch_job& job) { convert(job.infile, job.outfile, format, base64, 1); });
+        if (failed > 0) {
+            fprintf(stderr, "%zu of %zu files failed to convert.\n", failed, jobs.size());
+            return 1;
+        }
         return 0;
     }
     catch (const error::xcom_exception& e) {
         fprintf(stderr, "%s", e.what().c_str());
         return 1;
     }
-
-    fprintf(stderr, "Error: unknown error.\n");
-    return 1;
+    catch (const fs::filesystem_error& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
 }
@@ -0,0 +1,516 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "xcomcolumns.h"
+#include "xcomio.h"
+#include "xcomendian.h"
+#include "zlib.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace xcom
+{
+    static error::general_exception invalid_column_file(const std::string& why)
+    {
+        return error::general_exception("invalid column file: " + why);
+    }
+
+    void property_rows::clear()
+    {
+        save_id.clear();
+        checkpoint.clear();
+        path.clear();
+        kind.clear();
+        int_value.clear();
+        float_value.clear();
+        string_value.clear();
+    }
+
+    // Adds a row for each leaf value of the properties it visits.
+    struct column_property_visitor final : public property_visitor
+    {
+        column_property_visitor(property_rows& r, const std::string& s, const std::string& c,
+            const actor_table& a) :
+            rows(r), save_id(s), checkpoint(c), actors(a) {}
+
+        void dispatch(property& prop)
+        {
+            visit_property(prop, [this](auto& p) { visit(&p); });
+        }
+
+        virtual void visit(int_property *prop) override
+        {
+            add_row(prop->kind, prop->value, 0.0f, {});
+        }
+
+        virtual void visit(float_property *prop) override
+        {
+            add_row(prop->kind, 0, prop->value, {});
+        }
+
+        virtual void visit(bool_property *prop) override
+        {
+            add_row(prop->kind, prop->value ? 1 : 0, 0.0f, {});
+        }
+
+        virtual void visit(string_property *prop) override
+        {
+            add_row(prop->kind, 0, 0.0f, prop->str.str);
+        }
+
+        virtual void visit(object_property *prop) override
+        {
+            add_row(prop->kind, prop->actor, 0.0f, actor_name(prop->actor));
+        }
+
+        virtual void visit(name_property *prop) override
+        {
+            add_row(prop->kind, prop->number, 0.0f, prop->str);
+        }
+
+        virtual void visit(enum_property *prop) override
+        {
+            add_row(prop->kind, prop->value.number, 0.0f, prop->value.name);
+        }
+
+        virtual void visit(struct_property *prop) override
+        {
+            // Native struct data is opaque.
+            visit_list(prop->properties);
+        }
+
+        virtual void visit(array_property *) override
+        {
+            // Raw array data is opaque.
+        }
+
+        virtual void visit(object_array_property *prop) override
+        {
+            for (size_t i = 0; i < prop->elements.size(); ++i) {
+                element e{ *this, i };
+                add_row(prop->kind, prop->elements[i], 0.0f, actor_name(prop->elements[i]));
+            }
+        }
+
+        virtual void visit(number_array_property *prop) override
+        {
+            for (size_t i = 0; i < prop->elements.size(); ++i) {
+                element e{ *this, i };
+                add_row(prop->kind, prop->elements[i], 0.0f, {});
+            }
+        }
+
+        virtual void visit(struct_array_property *prop) override
+        {
+            for (size_t i = 0; i < prop->elements.size(); ++i) {
+                element e{ *this, i };
+                visit_list(prop->elements[i]);
+            }
+        }
+
+        virtual void visit(string_array_property *prop) override
+        {
+            for (size_t i = 0; i < prop->elements.size(); ++i) {
+                element e{ *this, i };
+                add_row(prop->kind, 0, 0.0f, prop->elements[i].str);
+            }
+        }
+
+        virtual void visit(enum_array_property *prop) override
+        {
+            for (size_t i = 0; i < prop->elements.size(); ++i) {
+                element e{ *this, i };
+                add_row(prop->kind, prop->elements[i].number, 0.0f, prop->elements[i].name);
+            }
+        }
+
+        virtual void visit(static_array_property *prop) override
+        {
+            // The elements have the same name as the array, so they're
+            // visited with the index in place of their name.
+            for (size_t i = 0; i < prop->properties.size(); ++i) {
+                element e{ *this, i };
+                dispatch(*prop->properties[i]);
+            }
+        }
+
+        // Visit a list of properties, each named under the current path.
+        void visit_list(const property_list& props)
+        {
+            for (const property_ptr& prop : props) {
+                size_t length = path.size();
+                if (!path.empty()) {
+                    path += '.';
+                }
+                path += prop->name;
+                dispatch(*prop);
+                path.resize(length);
+            }
+        }
+
+        // Appends an array index to the path for its lifetime.
+        struct element
+        {
+            element(column_property_visitor& v, size_t index) : visitor(v), length(v.path.size())
+            {
+                visitor.path += '[' + std::to_string(index) + ']';
+            }
+
+            ~element()
+            {
+                visitor.path.resize(length);
+            }
+
+            column_property_visitor& visitor;
+            size_t length;
+        };
+
+        std::string actor_name(int32_t actor) const
+        {
+            if (actor >= 0 && static_cast<size_t>(actor) < actors.size()) {
+                return actors[actor];
+            }
+            return {};
+        }
+
+        void add_row(property::kind_t kind, int32_t i, float f, const std::string& s)
+        {
+            rows.save_id.push_back(save_id);
+            rows.checkpoint.push_back(checkpoint);
+            rows.path.push_back(path);
+            rows.kind.push_back(static_cast<uint8_t>(kind));
+            rows.int_value.push_back(i);
+            rows.float_value.push_back(f);
+            rows.string_value.push_back(s);
+        }
+
+        property_rows& rows;
+        const std::string& save_id;
+        const std::string& checkpoint;
+        const actor_table& actors;
+        std::string path;
+    };
+
+    void flatten_properties(const std::string& save_id, saved_game& save, property_rows& rows)
+    {
+        for (checkpoint_chunk& chunk : save.checkpoints) {
+            for (checkpoint& chk : chunk.checkpoints) {
+                bool was_loaded = chk.properties_loaded;
+                column_property_visitor visitor{ rows, save_id, chk.instance_name, save.actors };
+                visitor.visit_list(chk.get_properties());
+
+                // Drop properties that were only parsed for this, unless
+                // they've been changed.
+                if (!was_loaded && !chk.dirty) {
+                    chk.properties.clear();
+                    chk.properties_loaded = false;
+                }
+            }
+        }
+    }
+
+    // Pack a column into its uncompressed form.
+    static std::string pack_strings(const std::vector<std::string>& column)
+    {
+        std::string packed(column.size() * sizeof(uint32_t), '\0');
+        for (size_t i = 0; i < column.size(); ++i) {
+            le_store(&packed[i * sizeof(uint32_t)], static_cast<uint32_t>(column[i].size()));
+        }
+        for (const std::string& s : column) {
+            packed += s;
+        }
+        return packed;
+    }
+
+    template <typename T>
+    static std::string pack_values(const std::vector<T>& column)
+    {
+        std::string packed(column.size() * sizeof(T), '\0');
+        le_store_array(&packed[0], column.data(), column.size());
+        return packed;
+    }
+
+    // Unpack a column, or fill it with empty values if it wasn't read.
+    static bool unpack_strings(const std::string& packed, bool was_read, size_t rows,
+        std::vector<std::string>& column)
+    {
+        if (!was_read) {
+            column.assign(rows, std::string());
+            return true;
+        }
+
+        size_t offset = rows * sizeof(uint32_t);
+        if (packed.size() < offset) {
+            return false;
+        }
+
+        column.clear();
+        column.reserve(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            uint32_t length = le_load<uint32_t>(&packed[i * sizeof length]);
+            if (length > packed.size() - offset) {
+                return false;
+            }
+            column.emplace_back(packed, offset, length);
+            offset += length;
+        }
+        return offset == packed.size();
+    }
+
+    template <typename T>
+    static bool unpack_values(const std::string& packed, bool was_read, size_t rows, std::vector<T>& column)
+    {
+        if (!was_read) {
+            column.assign(rows, T());
+            return true;
+        }
+        if (packed.size() != rows * sizeof(T)) {
+            return false;
+        }
+        column.resize(rows);
+        le_load_array(column.data(), packed.data(), rows);
+        return true;
+    }
+
+    column_writer::column_writer(const std::string& outfile)
+    {
+        fp_ = fopen(outfile.c_str(), "wb");
+        if (fp_ == nullptr) {
+            throw error::general_exception("error opening output file " + outfile);
+        }
+
+        unsigned char hdr[sizeof(column_format::file_header)];
+        memcpy(hdr, column_format::magic, sizeof column_format::magic);
+        le_store(hdr + offsetof(column_format::file_header, format_version), column_format::current_version);
+        le_store(hdr + offsetof(column_format::file_header, column_count),
+            static_cast<uint32_t>(column_format::column_count));
+        write_bytes(hdr, sizeof hdr);
+    }
+
+    column_writer::~column_writer()
+    {
+        try {
+            close();
+        }
+        catch (const error::xcom_exception&) {
+        }
+    }
+
+    void column_writer::write(size_t group, const property_rows& rows)
+    {
+        if (rows.size() == 0) {
+            skip(group);
+            return;
+        }
+
+        const std::string packed[column_format::column_count] = {
+            pack_strings(rows.save_id),
+            pack_strings(rows.checkpoint),
+            pack_strings(rows.path),
+            pack_values(rows.kind),
+            pack_values(rows.int_value),
+            pack_values(rows.float_value),
+            pack_strings(rows.string_value)
+        };
+
+        // Compress before taking the lock so other threads can do the same.
+        std::string bytes(sizeof(uint32_t), '\0');
+        le_store(&bytes[0], static_cast<uint32_t>(rows.size()));
+
+        for (const std::string& column : packed) {
+            uLongf compressed_size = compressBound(static_cast<uLong>(column.size()));
+            std::unique_ptr<unsigned char[]> compressed = std::make_unique<unsigned char[]>(compressed_size);
+            if (compress2(compressed.get(), &compressed_size, reinterpret_cast<const Bytef*>(column.data()),
+                static_cast<uLong>(column.size()), Z_DEFAULT_COMPRESSION) != Z_OK) {
+                throw error::general_exception("failed to compress column");
+            }
+
+            char col[sizeof(column_format::column_header)];
+            le_store(col + offsetof(column_format::column_header, uncompressed_size),
+                static_cast<uint32_t>(column.size()));
+            le_store(col + offsetof(column_format::column_header, compressed_size),
+                static_cast<uint32_t>(compressed_size));
+            bytes.append(col, sizeof col);
+            bytes.append(reinterpret_cast<const char*>(compressed.get()), compressed_size);
+        }
+
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        pending_.emplace(group, std::move(bytes));
+        write_pending();
+    }
+
+    void column_writer::skip(size_t group)
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        pending_.emplace(group, std::string());
+        write_pending();
+    }
+
+    void column_writer::write_pending()
+    {
+        // Groups that arrive early wait here for the ones before them.
+        while (!pending_.empty() && pending_.begin()->first == next_group_) {
+            const std::string& group = pending_.begin()->second;
+            write_bytes(group.data(), group.size());
+            pending_.erase(pending_.begin());
+            ++next_group_;
+        }
+    }
+
+    void column_writer::close()
+    {
+        std::lock_guard<std::mutex> lock{ mutex_ };
+        if (fp_ == nullptr) {
+            return;
+        }
+
+        // Write any groups still waiting on one that was never written.
+        for (const auto& pending : pending_) {
+            write_bytes(pending.second.data(), pending.second.size());
+        }
+        pending_.clear();
+
+        unsigned char end[sizeof(uint32_t)];
+        le_store(end, static_cast<uint32_t>(0));
+        write_bytes(end, sizeof end);
+        FILE *fp = fp_;
+        fp_ = nullptr;
+        if (fclose(fp) != 0) {
+            throw error::general_exception("error writing column file");
+        }
+    }
+
+    void column_writer::write_bytes(const void *data, size_t length)
+    {
+        if (fp_ == nullptr || fwrite(data, 1, length, fp_) != length) {
+            throw error::general_exception("error writing column file");
+        }
+    }
+
+    column_reader::column_reader(const std::string& infile, uint32_t columns) :
+        columns_{ columns }
+    {
+        fp_ = fopen(infile.c_str(), "rb");
+        if (fp_ == nullptr) {
+            throw error::general_exception("error opening input file " + infile);
+        }
+
+        column_format::file_header hdr;
+        unsigned char bytes[sizeof hdr];
+        if (!read_bytes(bytes, sizeof bytes)) {
+            fclose(fp_);
+            throw invalid_column_file("too short");
+        }
+        memcpy(hdr.magic, bytes, sizeof hdr.magic);
+        hdr.format_version = le_load<uint32_t>(bytes + offsetof(column_format::file_header, format_version));
+        hdr.column_count = le_load<uint32_t>(bytes + offsetof(column_format::file_header, column_count));
+
+        std::string why;
+        if (memcmp(hdr.magic, column_format::magic, sizeof column_format::magic) != 0) {
+            why = "bad magic number";
+        }
+        else if (hdr.format_version != column_format::current_version) {
+            why = "unsupported format version " + std::to_string(hdr.format_version);
+        }
+        else if (hdr.column_count != column_format::column_count) {
+            why = "unexpected column count";
+        }
+        if (!why.empty()) {
+            fclose(fp_);
+            throw invalid_column_file(why);
+        }
+    }
+
+    column_reader::~column_reader()
+    {
+        fclose(fp_);
+    }
+
+    bool column_reader::read_bytes(void *data, size_t length)
+    {
+        return fread(data, 1, length, fp_) == length;
+    }
+
+    bool column_reader::next(property_rows& rows)
+    {
+        unsigned char count[sizeof(uint32_t)];
+        if (!read_bytes(count, sizeof count)) {
+            throw invalid_column_file("missing end marker");
+        }
+        uint32_t row_count = le_load<uint32_t>(count);
+        if (row_count == 0) {
+            return false;
+        }
+
+        // Columns that weren't asked for are skipped over unread.
+        auto wanted = [this](column_format::column_id id) {
+            return (columns_ & column_format::column_bit(id)) != 0;
+        };
+        std::string packed[column_format::column_count];
+        std::string compressed;
+        for (uint32_t id = 0; id < column_format::column_count; ++id) {
+            column_format::column_header col;
+            unsigned char bytes[sizeof col];
+            if (!read_bytes(bytes, sizeof bytes)) {
+                throw invalid_column_file("truncated row group");
+            }
+            col.uncompressed_size = le_load<uint32_t>(bytes + offsetof(column_format::column_header, uncompressed_size));
+            col.compressed_size = le_load<uint32_t>(bytes + offsetof(column_format::column_header, compressed_size));
+
+            if (!wanted(static_cast<column_format::column_id>(id))) {
+                if (fseek(fp_, static_cast<long>(col.compressed_size), SEEK_CUR) != 0) {
+                    throw invalid_column_file("truncated row group");
+                }
+                continue;
+            }
+
+            compressed.resize(col.compressed_size);
+            if (!read_bytes(&compressed[0], compressed.size())) {
+                throw invalid_column_file("truncated row group");
+            }
+
+            std::string& column = packed[id];
+            column.resize(col.uncompressed_size);
+            uLongf length = col.uncompressed_size;
+            if (uncompress(reinterpret_cast<Bytef*>(&column[0]), &length,
+                reinterpret_cast<const Bytef*>(compressed.data()), col.compressed_size) != Z_OK ||
+                length != col.uncompressed_size) {
+                throw invalid_column_file("failed to decompress column");
+            }
+        }
+
+        bool ok = unpack_strings(packed[column_format::save_id], wanted(column_format::save_id),
+                row_count, rows.save_id) &&
+            unpack_strings(packed[column_format::checkpoint], wanted(column_format::checkpoint),
+                row_count, rows.checkpoint) &&
+            unpack_strings(packed[column_format::path], wanted(column_format::path), row_count, rows.path) &&
+            unpack_values(packed[column_format::kind], wanted(column_format::kind), row_count, rows.kind) &&
+            unpack_values(packed[column_format::int_value], wanted(column_format::int_value),
+                row_count, rows.int_value) &&
+            unpack_values(packed[column_format::float_value], wanted(column_format::float_value),
+                row_count, rows.float_value) &&
+            unpack_strings(packed[column_format::string_value], wanted(column_format::string_value),
+                row_count, rows.string_value);
+        if (!ok) {
+            throw invalid_column_file("column sizes don't match the row count");
+        }
+        return true;
+    }
+}
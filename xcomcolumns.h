@@ -0,0 +1,192 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMCOLUMNS_H
+#define XCOMCOLUMNS_H
+
+#include "xcom.h"
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+namespace xcom
+{
+    // A column file holds the properties of any number of saves flattened
+    // into rows, one row per leaf value, stored column by column so that
+    // analysis tools can load just the columns they need: column_reader
+    // skips the others using their compressed sizes, without reading or
+    // decompressing them.
+    //
+    // The file is a file_header followed by row groups. Each row group is a
+    // uint32_t row count followed by each column in column_id order: a
+    // column_header and then the column data compressed with zlib. A row
+    // group with a row count of zero ends the file. All integers are
+    // little-endian.
+    //
+    // Once decompressed, int columns are row_count int32_t values, float
+    // columns row_count floats and kind columns row_count bytes. String
+    // columns are row_count uint32_t lengths followed by the string bytes
+    // (UTF-8) one after another.
+    namespace column_format
+    {
+        static const char magic[4] = { 'X', 'C', 'C', 'F' };
+        static const uint32_t current_version = 1;
+
+        enum column_id
+        {
+            save_id,        // string: the save the row came from
+            checkpoint,     // string: the instance name of the checkpoint
+            path,           // string: the property path (see below)
+            kind,           // byte: a property::kind_t
+            int_value,      // int32_t
+            float_value,    // float
+            string_value,   // string
+            column_count
+        };
+
+        // The bit for a column in a column_reader's set of columns to read.
+        inline uint32_t column_bit(column_id id)
+        {
+            return 1u << id;
+        }
+
+        static const uint32_t all_columns = (1u << column_count) - 1;
+
+        struct file_header
+        {
+            char magic[4];
+            uint32_t format_version;
+            uint32_t column_count;
+        };
+
+        struct column_header
+        {
+            uint32_t uncompressed_size;
+            uint32_t compressed_size;
+        };
+    }
+
+    // Rows of flattened properties, one vector per column.
+    //
+    // The path names a value the same way save_patcher does: struct members
+    // follow their struct after a '.', and elements of static and dynamic
+    // arrays are selected with an index in brackets, e.g.
+    // m_kChar.aStats[1] or m_arrSoldiers[3].iRank.
+    //
+    // The kind is that of the property the value came from; elements of
+    // arrays have the kind of the array. Which value columns are set
+    // depends on it:
+    //
+    //   int, bool:              int_value
+    //   float:                  float_value
+    //   number array:           int_value (the raw bits, which may be a float)
+    //   object, object array:   int_value = actor index (-1 for none),
+    //                           string_value = actor name
+    //   string, string array:   string_value
+    //   name, enum, enum array: string_value = name, int_value = number
+    //
+    // Unused value columns hold 0 or the empty string. Raw arrays and
+    // structs with native data have no rows.
+    struct property_rows
+    {
+        std::vector<std::string> save_id;
+        std::vector<std::string> checkpoint;
+        std::vector<std::string> path;
+        std::vector<uint8_t> kind;
+        std::vector<int32_t> int_value;
+        std::vector<float> float_value;
+        std::vector<std::string> string_value;
+
+        size_t size() const {
+            return kind.size();
+        }
+
+        void clear();
+    };
+
+    // Flatten the properties of a save into rows. Checkpoints read with
+    // read_options::lazy_properties are parsed one at a time and their
+    // properties released again afterwards, so only one checkpoint's
+    // property tree is in memory at once.
+    void flatten_properties(const std::string& save_id, saved_game& save, property_rows& rows);
+
+    // Writes a column file. Rows are added a row group at a time, and
+    // write() may be called from several threads at once. Each group has a
+    // number, and groups are written in that order whatever order they're
+    // added in: a group that arrives early is held until those before it
+    // have been written or skipped.
+    class column_writer
+    {
+    public:
+        explicit column_writer(const std::string& outfile);
+        ~column_writer();
+
+        column_writer(const column_writer&) = delete;
+        column_writer& operator=(const column_writer&) = delete;
+
+        // Add rows as row group number 'group', counting from 0. Each
+        // number must be written or skipped once. A group with no rows is
+        // skipped.
+        void write(size_t group, const property_rows& rows);
+
+        // Add nothing in place of row group number 'group', e.g. for a save
+        // that couldn't be read.
+        void skip(size_t group);
+
+        // Write any groups still held, the end marker, and close the file.
+        // Called by the destructor if not called before, but errors can only
+        // be reported from here.
+        void close();
+
+    private:
+        void write_pending();
+        void write_bytes(const void *data, size_t length);
+
+        FILE *fp_;
+        std::mutex mutex_;
+        std::map<size_t, std::string> pending_;
+        size_t next_group_ = 0;
+    };
+
+    // Reads a column file one row group at a time. Only the columns with
+    // their column_bit() set in 'columns' are read; the rest are skipped
+    // over in the file and come back as 0 or the empty string.
+    class column_reader
+    {
+    public:
+        explicit column_reader(const std::string& infile, uint32_t columns = column_format::all_columns);
+        ~column_reader();
+
+        column_reader(const column_reader&) = delete;
+        column_reader& operator=(const column_reader&) = delete;
+
+        // Read the next row group into rows, replacing their contents.
+        // Returns false at the end of the file.
+        bool next(property_rows& rows);
+
+    private:
+        bool read_bytes(void *data, size_t length);
+
+        FILE *fp_;
+        uint32_t columns_;
+    };
+}
+
+#endif // XCOMCOLUMNS_H
@@ -0,0 +1,154 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMENDIAN_H
+#define XCOMENDIAN_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+namespace xcom
+{
+    // Saves are little-endian on every platform. All numbers read from or
+    // written to save data go through le_load and le_store, which copy the
+    // bytes (so the data needn't be aligned) and swap them on a big-endian
+    // host. On a little-endian host they compile to a plain load or store.
+
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    constexpr bool host_is_little_endian = false;
+#elif defined(__BYTE_ORDER__) || defined(_MSC_VER)
+    constexpr bool host_is_little_endian = true;
+#else
+#error "Unknown byte order: define __BYTE_ORDER__"
+#endif
+
+    namespace detail
+    {
+        // The unsigned integer type with the same size as T.
+        template <size_t Size> struct uint_of_size;
+        template <> struct uint_of_size<1> { using type = uint8_t; };
+        template <> struct uint_of_size<2> { using type = uint16_t; };
+        template <> struct uint_of_size<4> { using type = uint32_t; };
+        template <> struct uint_of_size<8> { using type = uint64_t; };
+
+        inline uint8_t byteswap(uint8_t v) { return v; }
+
+        inline uint16_t byteswap(uint16_t v)
+        {
+#if defined(_MSC_VER)
+            return _byteswap_ushort(v);
+#else
+            return __builtin_bswap16(v);
+#endif
+        }
+
+        inline uint32_t byteswap(uint32_t v)
+        {
+#if defined(_MSC_VER)
+            return _byteswap_ulong(v);
+#else
+            return __builtin_bswap32(v);
+#endif
+        }
+
+        inline uint64_t byteswap(uint64_t v)
+        {
+#if defined(_MSC_VER)
+            return _byteswap_uint64(v);
+#else
+            return __builtin_bswap64(v);
+#endif
+        }
+    }
+
+    // Load a little-endian number from p.
+    template <typename T>
+    T le_load(const void *p)
+    {
+        static_assert(std::is_arithmetic<T>::value, "le_load needs a number type");
+        using uint_type = typename detail::uint_of_size<sizeof(T)>::type;
+        uint_type bits;
+        memcpy(&bits, p, sizeof bits);
+        if (!host_is_little_endian) {
+            bits = detail::byteswap(bits);
+        }
+        T v;
+        memcpy(&v, &bits, sizeof v);
+        return v;
+    }
+
+    // Store a number at p in little-endian order.
+    template <typename T>
+    void le_store(void *p, T v)
+    {
+        static_assert(std::is_arithmetic<T>::value, "le_store needs a number type");
+        using uint_type = typename detail::uint_of_size<sizeof(T)>::type;
+        uint_type bits;
+        memcpy(&bits, &v, sizeof bits);
+        if (!host_is_little_endian) {
+            bits = detail::byteswap(bits);
+        }
+        memcpy(p, &bits, sizeof bits);
+    }
+
+    // Load count consecutive little-endian numbers from p into out. A single
+    // copy on a little-endian host.
+    template <typename T>
+    void le_load_array(T *out, const void *p, size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "le_load_array needs a number type");
+        if (host_is_little_endian) {
+            if (count > 0) {
+                memcpy(out, p, count * sizeof(T));
+            }
+        }
+        else {
+            const unsigned char *bytes = static_cast<const unsigned char*>(p);
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = le_load<T>(bytes + i * sizeof(T));
+            }
+        }
+    }
+
+    // Store count numbers at p in little-endian order.
+    template <typename T>
+    void le_store_array(void *p, const T *values, size_t count)
+    {
+        static_assert(std::is_arithmetic<T>::value, "le_store_array needs a number type");
+        if (host_is_little_endian) {
+            if (count > 0) {
+                memcpy(p, values, count * sizeof(T));
+            }
+        }
+        else {
+            unsigned char *bytes = static_cast<unsigned char*>(p);
+            for (size_t i = 0; i < count; ++i) {
+                le_store(bytes + i * sizeof(T), values[i]);
+            }
+        }
+    }
+}
+
+#endif // XCOMENDIAN_H
@@ -0,0 +1,109 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "xcomindex.h"
+
+namespace xcom
+{
+    checkpoint_index::checkpoint_index(saved_game& save) :
+        checkpoint_index(save.checkpoints, save.actors)
+    {
+    }
+
+    checkpoint_index::checkpoint_index(checkpoint_chunk_table& chunks, const actor_table& actors)
+    {
+        for (checkpoint_chunk& chunk : chunks) {
+            for (checkpoint& chk : chunk.checkpoints) {
+                add(chk);
+            }
+        }
+
+        global_actors_ = resolve(actors);
+        for (const checkpoint_chunk& chunk : chunks) {
+            local_actors_.push_back(resolve(chunk.actors));
+        }
+    }
+
+    void checkpoint_index::add(checkpoint& chk)
+    {
+        // The first checkpoint with a name wins, as with a linear search.
+        by_name_.emplace(chk.instance_name, &chk);
+        by_name_.emplace(chk.name, &chk);
+
+        by_class_[chk.class_name].push_back(&chk);
+        size_t dot = chk.class_name.find_last_of('.');
+        if (dot != std::string::npos) {
+            by_class_[chk.class_name.substr(dot + 1)].push_back(&chk);
+        }
+
+        // Checkpoint names look like
+        // Command1.TheWorld:PersistentLevel.XGStrategy_0, and the actor
+        // table names the same actor Command1.XGStrategy_0 (EW) or
+        // XGStrategy_0 (EU).
+        by_actor_name_.emplace(chk.instance_name, &chk);
+        size_t package_end = chk.name.find('.');
+        if (package_end != std::string::npos) {
+            by_actor_name_.emplace(chk.name.substr(0, package_end + 1) + chk.instance_name, &chk);
+        }
+    }
+
+    std::vector<checkpoint*> checkpoint_index::resolve(const actor_table& actors) const
+    {
+        std::vector<checkpoint*> resolved;
+        resolved.reserve(actors.size());
+        std::string name;
+        for (size_t i = 0; i < actors.size(); ++i) {
+            name.clear();
+            actors.append_name(i, name);
+            auto it = by_actor_name_.find(name);
+            resolved.push_back(it == by_actor_name_.end() ? nullptr : it->second);
+        }
+        return resolved;
+    }
+
+    checkpoint* checkpoint_index::find(const std::string& name) const
+    {
+        auto it = by_name_.find(name);
+        return it == by_name_.end() ? nullptr : it->second;
+    }
+
+    const std::vector<checkpoint*>& checkpoint_index::find_class(const std::string& class_name) const
+    {
+        static const std::vector<checkpoint*> none;
+        auto it = by_class_.find(class_name);
+        return it == by_class_.end() ? none : it->second;
+    }
+
+    checkpoint* checkpoint_index::find_actor(int32_t actor) const
+    {
+        if (actor < 0 || static_cast<size_t>(actor) >= global_actors_.size()) {
+            return nullptr;
+        }
+        return global_actors_[actor];
+    }
+
+    checkpoint* checkpoint_index::find_local_actor(size_t chunk, int32_t actor) const
+    {
+        if (chunk >= local_actors_.size() || actor < 0 ||
+                static_cast<size_t>(actor) >= local_actors_[chunk].size()) {
+            return nullptr;
+        }
+        return local_actors_[chunk][actor];
+    }
+}
@@ -0,0 +1,75 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMINDEX_H
+#define XCOMINDEX_H
+
+#include "xcom.h"
+
+#include <unordered_map>
+
+namespace xcom
+{
+    // Constant-time lookup of checkpoints by name, by class and by actor.
+    //
+    // The index points into the checkpoint tables it was built from, so it
+    // is only valid while they're alive and no checkpoints or chunks are
+    // added or removed. Changing the checkpoints themselves is fine, except
+    // for their names.
+    class checkpoint_index
+    {
+    public:
+        explicit checkpoint_index(saved_game& save);
+        checkpoint_index(checkpoint_chunk_table& chunks, const actor_table& actors);
+
+        // The checkpoint with an instance name (e.g. XGStrategy_0) or full
+        // name (e.g. Command1.TheWorld:PersistentLevel.XGStrategy_0), or null
+        // if there's none.
+        checkpoint* find(const std::string& name) const;
+
+        // The checkpoints of a class, named either with or without its
+        // package (XComStrategyGame.XGStrategySoldier or XGStrategySoldier),
+        // in the order they appear in the save.
+        const std::vector<checkpoint*>& find_class(const std::string& class_name) const;
+
+        // The checkpoint of an entry in the global actor table, e.g. the
+        // actor of an object property. Null for -1, an index out of range,
+        // or an actor with no checkpoint.
+        checkpoint* find_actor(int32_t actor) const;
+
+        // As find_actor(), for an entry in the local actor table of a chunk.
+        checkpoint* find_local_actor(size_t chunk, int32_t actor) const;
+
+    private:
+        void add(checkpoint& chk);
+        std::vector<checkpoint*> resolve(const actor_table& actors) const;
+
+        std::unordered_map<std::string, checkpoint*> by_name_;
+        std::unordered_map<std::string, std::vector<checkpoint*>> by_class_;
+
+        // Keyed by the name the actor table uses for a checkpoint's actor:
+        // <package>.<instance name> in EW saves, the instance name in EU.
+        std::unordered_map<std::string, checkpoint*> by_actor_name_;
+
+        std::vector<checkpoint*> global_actors_;
+        std::vector<std::vector<checkpoint*>> local_actors_;
+    };
+}
+
+#endif // XCOMINDEX_H
@@ -47,13 +47,13 @@ namespace xcom
         switch (k)
         {
         case seek_kind::start:
-            ptr_ = start_.get() + offset;
+            ptr_ = start_ + offset;
             break;
         case seek_kind::current:
             ptr_ += offset;
             break;
         case seek_kind::end:
-            ptr_ = start_.get() + length_ + offset;
+            ptr_ = start_ + length_ + offset;
         }
     }
 
@@ -67,7 +67,7 @@ namespace xcom
         if (!bounds_check(4)) {
             throw error::format_exception(offset(), "read_int: EOF");
         }
-        int32_t v = *(reinterpret_cast<const int32_t*>(ptr_));
+        int32_t v = le_load<int32_t>(ptr_);
         ptr_ += 4;
         return v;
     }
@@ -77,7 +77,7 @@ namespace xcom
         if (!bounds_check(4)) {
             throw error::format_exception(offset(), "read_float: EOF");
         }
-        float f = *(reinterpret_cast<const float*>(ptr_));
+        float f = le_load<float>(ptr_);
         ptr_ += 4;
         return f;
     }
@@ -116,7 +116,7 @@ namespace xcom
             // A UTF-16 encoded string.
             length = -length;
 
-            if (!bounds_check(length)) {
+            if (length < 0 || !bounds_check(2 * static_cast<size_t>(length))) {
                 if (throw_on_error) {
                     throw error::format_exception(offset(), "read_string found an invalid string length");
                 }
@@ -124,7 +124,16 @@ namespace xcom
                     return{ "", false };
                 }
             }
-            const char16_t *str = reinterpret_cast<const char16_t*>(ptr_);
+            // The length counts the terminating null.
+            std::u16string str;
+            str.reserve(length - 1);
+            for (int32_t i = 0; i < length - 1; ++i) {
+                char16_t c = le_load<char16_t>(ptr_ + 2 * i);
+                if (c == 0) {
+                    break;
+                }
+                str.push_back(c);
+            }
             ptr_ += 2 * length;
             return{ util::utf16_to_utf8(str), true };
         }
@@ -189,15 +198,24 @@ namespace xcom
         std::ptrdiff_t current_count = offset();
 
         if ((current_count + count) > length_) {
-            int32_t new_length = static_cast<int32_t>(length_ * 2);
-            if (new_length < 0) {
+            if (owned_ == nullptr) {
+                throw xcom::error::general_exception("write past the end of a fixed buffer");
+            }
+            // Keep doubling until the request fits: a caller may reserve
+            // space for many writes at once.
+            size_t new_length = length_ * 2;
+            while (new_length < current_count + count) {
+                new_length *= 2;
+            }
+            if (new_length > static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
                 throw xcom::error::general_exception("save file overflow");
             }
             unsigned char * new_buffer = new unsigned char[new_length];
-            memcpy(new_buffer, start_.get(), current_count);
-            start_.reset(new_buffer);
+            memcpy(new_buffer, start_, current_count);
+            owned_.reset(new_buffer);
+            start_ = new_buffer;
             length_ = new_length;
-            ptr_ = start_.get() + current_count;
+            ptr_ = start_ + current_count;
         }
     }
 
@@ -227,7 +245,7 @@ namespace xcom
             // null character 
             write_int(terminated_character_count * -1);
             // Copy 2*length bytes of string data
-            memcpy(ptr_, conv16.c_str(), conv16.length() * 2);
+            le_store_array(ptr_, conv16.data(), conv16.length());
             ptr_ += conv16.length() * 2;
 
             // Write a double terminating null
@@ -254,7 +272,7 @@ namespace xcom
     void xcom_io::write_int(int32_t val)
     {
         ensure(4);
-        *(reinterpret_cast<int32_t*>(ptr_)) = val;
+        le_store(ptr_, val);
         ptr_ += 4;
     }
 
@@ -262,7 +280,7 @@ namespace xcom
     void xcom_io::write_float(float val)
     {
         ensure(4);
-        *(reinterpret_cast<float*>(ptr_)) = val;
+        le_store(ptr_, val);
         ptr_ += 4;
     }
 
@@ -277,7 +295,7 @@ namespace xcom
         *ptr_++ = c;
     }
 
-    void xcom_io::write_raw(unsigned char *buf, int32_t len)
+    void xcom_io::write_raw(const unsigned char *buf, int32_t len)
     {
         ensure(len);
         memcpy(ptr_, buf, len);
@@ -21,9 +21,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #define XCOMREADER_H
 
 #include <stdint.h>
+#include <cassert>
+#include <cstring>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #include "xcom.h"
+#include "xcomendian.h"
 #include "util.h"
 
 namespace xcom
@@ -39,16 +44,25 @@ namespace xcom
         // Construct an xcom_io object from an existing buffer (e.g.
         // a raw save file).
         xcom_io(buffer<unsigned char>&& b) :
-            start_(std::move(b.buf)), length_(b.length)
+            owned_(std::move(b.buf)), length_(b.length)
         {
-            ptr_ = start_.get();
+            start_ = owned_.get();
+            ptr_ = start_;
         }
 
+        // Construct an xcom_io object over memory owned by someone else, e.g.
+        // the decompressed data of a save_source. The memory must outlive
+        // this object, and the buffer can't grow: an attempt to write past
+        // the end throws.
+        xcom_io(unsigned char *data, size_t length) :
+            start_(data), ptr_(data), length_(length) {}
+
         // Construct an empty xcom_io object, e.g. for writing a save.
         xcom_io()
         {
-            start_ = std::make_unique<unsigned char[]>(initial_size);
-            ptr_ = start_.get();
+            owned_ = std::make_unique<unsigned char[]>(initial_size);
+            start_ = owned_.get();
+            ptr_ = start_;
             length_ = initial_size;
         }
 
@@ -56,7 +70,7 @@ namespace xcom
 
         // Return the current offset of the cursor within the buffer.
         std::ptrdiff_t offset() const {
-            return ptr_ - start_.get();
+            return ptr_ - start_;
         }
 
         // Return the current size of the buffer.
@@ -69,6 +83,10 @@ namespace xcom
             return ptr_;
         }
 
+        unsigned char * pointer() {
+            return ptr_;
+        }
+
         // Are we at the end of the file?
         bool eof() const
         {
@@ -76,10 +94,11 @@ namespace xcom
         }
 
         // Extract the raw buffer from the io object. After this the
-        // io object is empty (length 0 and holds no pointer).
+        // io object is empty (length 0 and holds no pointer). Only valid
+        // for objects that own their buffer.
         buffer<unsigned char> release() {
-            buffer<unsigned char> b = { std::move(start_), length_ };
-            start_.reset();
+            buffer<unsigned char> b = { std::move(owned_), length_ };
+            start_ = nullptr;
             ptr_ = nullptr;
             length_ = 0;
             return b;
@@ -122,6 +141,44 @@ namespace xcom
         // Read a single byte
         unsigned char read_byte();
 
+        // Read a number, e.g. an int32_t or a float. It needn't be aligned.
+        template <typename T>
+        T read()
+        {
+            if (!bounds_check(sizeof(T))) {
+                throw error::format_exception(offset(), "read: EOF when trying to read %d bytes",
+                    static_cast<int>(sizeof(T)));
+            }
+            T v = le_load<T>(ptr_);
+            ptr_ += sizeof v;
+            return v;
+        }
+
+        // Read count consecutive numbers into out.
+        template <typename T>
+        void read_array(T *out, size_t count)
+        {
+            if (count > (length_ - offset()) / sizeof(T)) {
+                throw error::format_exception(offset(), "read_array: EOF when trying to read %d values",
+                    static_cast<int>(count));
+            }
+            le_load_array(out, ptr_, count);
+            ptr_ += count * sizeof(T);
+        }
+
+        template <typename T>
+        std::vector<T> read_array(size_t count)
+        {
+            // Check before allocating: count may come from a corrupt save.
+            if (count > (length_ - offset()) / sizeof(T)) {
+                throw error::format_exception(offset(), "read_array: EOF when trying to read %d values",
+                    static_cast<int>(count));
+            }
+            std::vector<T> values(count);
+            read_array(values.data(), count);
+            return values;
+        }
+
         // Read count bytes from the save
         std::unique_ptr<unsigned char[]> read_raw_bytes(int32_t count);
 
@@ -155,11 +212,24 @@ namespace xcom
         void write_byte(unsigned char c);
 
         // Write len bytes pointed to by buf
-        void write_raw(unsigned char *buf, int32_t len);
+        void write_raw(const unsigned char *buf, int32_t len);
+
+        // Write count consecutive numbers.
+        template <typename T>
+        void write_array(const T *values, size_t count)
+        {
+            ensure(count * sizeof(T));
+            le_store_array(ptr_, values, count);
+            ptr_ += count * sizeof(T);
+        }
 
     protected:
-        // The buffer itself, always points to the start of the owned memory.
-        std::unique_ptr<unsigned char[]> start_;
+        // The owned buffer, or null if this object is a view over memory
+        // owned elsewhere.
+        std::unique_ptr<unsigned char[]> owned_;
+
+        // The start of the buffer, owned or not.
+        unsigned char *start_;
 
         // The current cursor into the buffer.
         unsigned char *ptr_;
@@ -168,5 +238,83 @@ namespace xcom
         size_t length_;
     };
 
+    // Reads a record of known size with a single bounds check. The
+    // constructor checks that the bytes are there and moves the xcom_io past
+    // them; reads then come from those bytes with no further checks. Reading
+    // more than was reserved is a bug, caught by an assert.
+    //
+    //   span_reader s{ r, 24 };
+    //   s.read_array(chk.vector.data(), 3);
+    //   s.read_array(chk.rotator.data(), 3);
+    class span_reader
+    {
+    public:
+        span_reader(xcom_io& io, size_t count) :
+            start_offset_(io.offset()), start_(io.pointer()), ptr_(start_), end_(start_ + count)
+        {
+            if (!io.bounds_check(count)) {
+                throw error::format_exception(io.offset(), "EOF when trying to read a %d byte record",
+                    static_cast<int>(count));
+            }
+            io.seek(xcom_io::seek_kind::current, count);
+        }
+
+        span_reader(const span_reader&) = delete;
+        span_reader& operator=(const span_reader&) = delete;
+
+        template <typename T>
+        T read()
+        {
+            assert(ptr_ + sizeof(T) <= end_);
+            T v = le_load<T>(ptr_);
+            ptr_ += sizeof v;
+            return v;
+        }
+
+        int32_t read_int() { return read<int32_t>(); }
+        float read_float() { return read<float>(); }
+
+        template <typename T>
+        void read_array(T *out, size_t count)
+        {
+            assert(ptr_ + count * sizeof(T) <= end_);
+            le_load_array(out, ptr_, count);
+            ptr_ += count * sizeof(T);
+        }
+
+        // The offset in the save of the next read, for error messages.
+        std::ptrdiff_t offset() const {
+            return start_offset_ + (ptr_ - start_);
+        }
+
+    private:
+        std::ptrdiff_t start_offset_;
+        const unsigned char *start_;
+        const unsigned char *ptr_;
+        const unsigned char *end_;
+    };
+
+    // Reader and writer internals shared with other parts of the library.
+
+    buffer<unsigned char> read_file(const std::string& filename);
+
+    // Read and validate the header of a save and decompress its body. The
+    // returned source also holds the save itself and the chunk index.
+    save_source read_save_source(buffer<unsigned char>&& b, header &hdr);
+
+    actor_table read_actor_table(xcom_io &r, xcom_version version);
+
+    // Read the checkpoint chunks from the decompressed body of a save. If
+    // source is non-null, checkpoints and chunks record their spans in it. If
+    // lazy is also set, checkpoint properties are skipped instead of parsed.
+    checkpoint_chunk_table read_checkpoint_chunk_table(xcom_io &r, xcom_version version,
+        const std::shared_ptr<const save_source> &source, bool lazy);
+
+    // Build a save from the (possibly modified) decompressed body in src.
+    // Chunks flagged in dirty_chunks are recompressed, all others are copied
+    // from src.compressed. The chunk boundaries are those of src.chunks.
+    buffer<unsigned char> recompress_save(const header &hdr, const save_source &src,
+        const std::vector<bool> &dirty_chunks);
+
 } // namespace xcom
 #endif //XCOM_H
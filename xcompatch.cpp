@@ -0,0 +1,91 @@
+
+#include "xcom.h"
+#include "xcompatcher.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <locale>
+
+using namespace xcom;
+
+void usage(const char * name)
+{
+    printf("Usage: %s [-o <out_file>] <in_file> <path>=<value> [<path>=<value> ...]\n", name);
+    printf("-o -- Specify output file name, defaults to <in_file>.out\n");
+    printf("Sets int, float, bool and object properties without converting the save to json.\n");
+    printf("Paths look like XGHeadQuarters.m_iCash or XGHeadQuarters.m_arrItems[172].\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::string infile;
+    std::string outfile;
+    std::vector<std::pair<std::string, std::string>> edits;
+
+    if (argc <= 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setlocale(LC_ALL, "en_US.utf8");
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0) {
+            if (argc <= (i+1)) {
+                usage(argv[0]);
+                return 1;
+            }
+            outfile = argv[++i];
+        }
+        else if (infile.empty()) {
+            infile = argv[i];
+        }
+        else {
+            const char *eq = strchr(argv[i], '=');
+            if (eq == nullptr) {
+                usage(argv[0]);
+                return 1;
+            }
+            edits.emplace_back(std::string(argv[i], eq - argv[i]), std::string(eq + 1));
+        }
+    }
+
+    if (infile.empty() || edits.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (outfile.empty()) {
+        outfile = infile + ".out";
+    }
+
+    try {
+        save_patcher patcher{ infile };
+        for (const auto& edit : edits) {
+            patcher.set(edit.first, edit.second);
+        }
+        patcher.write(outfile);
+
+        // Read the edits back from the written save, to be sure each path
+        // landed on the value it names.
+        save_patcher written{ outfile };
+        for (const auto& edit : edits) {
+            std::string expected = patcher.get(edit.first);
+            std::string actual = written.get(edit.first);
+            if (actual != expected) {
+                fprintf(stderr, "Error: %s reads back as %s, expected %s\n", edit.first.c_str(),
+                    actual.c_str(), expected.c_str());
+                return 1;
+            }
+        }
+        return 0;
+    }
+    catch (const error::xcom_exception& e) {
+        fprintf(stderr, "%s", e.what().c_str());
+        return 1;
+    }
+
+    fprintf(stderr, "Error: unknown error.\n");
+    return 1;
+}
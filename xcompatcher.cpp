@@ -0,0 +1,226 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+/*
+xcompatcher.cpp - In-place edits of fixed-size values in a save.
+*/
+
+#include "xcompatcher.h"
+#include "xcomio.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+namespace xcom
+{
+    save_patcher::save_patcher(buffer<unsigned char>&& save)
+    {
+        source_ = std::make_shared<save_source>(read_save_source(std::move(save), hdr_));
+
+        // Find the checkpoints but don't parse any of their properties.
+        xcom_io r{ source_->data.buf.get(), source_->data.length };
+        actor_table actors = read_actor_table(r, hdr_.version);
+        chunks_ = read_checkpoint_chunk_table(r, hdr_.version, source_, true);
+        index_ = std::make_unique<checkpoint_index>(chunks_, actors);
+        dirty_chunks_.resize(source_->chunks.size());
+    }
+
+    save_patcher::save_patcher(const std::string& infile) :
+        save_patcher(read_file(infile))
+    {
+    }
+
+    value_location save_patcher::locate(const std::string& path) const
+    {
+        property_selector selector{ path };
+        value_location loc = locate_value(find_checkpoint(*index_, selector), selector);
+        switch (loc.kind)
+        {
+        case property::kind_t::int_property:
+        case property::kind_t::float_property:
+        case property::kind_t::bool_property:
+        case property::kind_t::object_property:
+            return loc;
+        default:
+            throw error::general_exception(path + " is a " + property_kind_to_string(loc.kind) +
+                ", not a fixed-size value");
+        }
+    }
+
+    void save_patcher::overwrite(const value_location& loc, const unsigned char *bytes)
+    {
+        memcpy(source_->data.buf.get() + loc.offset, bytes, loc.size);
+
+        // Flag every chunk the value overlaps: it may straddle two.
+        for (size_t i = 0; i < source_->chunks.size(); ++i) {
+            const compressed_chunk &chunk = source_->chunks[i];
+            size_t chunk_end = chunk.uncompressed_offset + chunk.uncompressed_size;
+            if (loc.offset < chunk_end && loc.offset + loc.size > chunk.uncompressed_offset) {
+                dirty_chunks_[i] = true;
+            }
+        }
+    }
+
+    property::kind_t save_patcher::kind(const std::string& path) const
+    {
+        return locate(path).kind;
+    }
+
+    std::string save_patcher::get(const std::string& path) const
+    {
+        // Objects are given as actor indices, the form set() accepts.
+        property_value v = read_value(*source_, locate(path), nullptr);
+        return v.to_string();
+    }
+
+    void save_patcher::set_int(const std::string& path, int32_t value)
+    {
+        value_location loc = locate(path);
+        if (loc.kind != property::kind_t::int_property) {
+            throw error::general_exception(path + " is not an int");
+        }
+
+        // Byte fields of native structs (e.g. the R of a Color) hold 0-255.
+        if (loc.size == 1) {
+            if (value < 0 || value > 255) {
+                throw error::general_exception(path + " is a byte: " + std::to_string(value) + " is out of range");
+            }
+            unsigned char c = static_cast<unsigned char>(value);
+            overwrite(loc, &c);
+            return;
+        }
+        unsigned char bytes[4];
+        le_store(bytes, value);
+        overwrite(loc, bytes);
+    }
+
+    void save_patcher::set_float(const std::string& path, float value)
+    {
+        value_location loc = locate(path);
+        if (loc.kind != property::kind_t::float_property) {
+            throw error::general_exception(path + " is not a float");
+        }
+        unsigned char bytes[4];
+        le_store(bytes, value);
+        overwrite(loc, bytes);
+    }
+
+    void save_patcher::set_bool(const std::string& path, bool value)
+    {
+        value_location loc = locate(path);
+        if (loc.kind != property::kind_t::bool_property) {
+            throw error::general_exception(path + " is not a bool");
+        }
+        unsigned char c = value ? 1 : 0;
+        overwrite(loc, &c);
+    }
+
+    void save_patcher::set_object(const std::string& path, int32_t actor)
+    {
+        value_location loc = locate(path);
+        if (loc.kind != property::kind_t::object_property) {
+            throw error::general_exception(path + " is not an object");
+        }
+
+        // Objects are stored as a single actor number in EU, and in EW (and
+        // in arrays) as a related pair of numbers: see read_properties.
+        int32_t actors[2];
+        if (loc.size == 4) {
+            actors[0] = actor;
+        }
+        else if (actor == -1) {
+            actors[0] = actors[1] = -1;
+        }
+        else {
+            actors[0] = actor * 2 + 1;
+            actors[1] = actor * 2;
+        }
+        unsigned char bytes[8];
+        le_store_array(bytes, actors, loc.size / 4);
+        overwrite(loc, bytes);
+    }
+
+    void save_patcher::set(const std::string& path, const std::string& value)
+    {
+        property::kind_t k = kind(path);
+        const char *str = value.c_str();
+        char *end;
+        errno = 0;
+
+        switch (k)
+        {
+        case property::kind_t::int_property:
+        case property::kind_t::object_property:
+        {
+            long v = strtol(str, &end, 10);
+            if (end == str || *end != '\0' || errno != 0 || v < std::numeric_limits<int32_t>::min() ||
+                    v > std::numeric_limits<int32_t>::max()) {
+                throw error::general_exception("expected an integer value for " + path + ": " + value);
+            }
+            if (k == property::kind_t::int_property) {
+                set_int(path, static_cast<int32_t>(v));
+            }
+            else {
+                set_object(path, static_cast<int32_t>(v));
+            }
+            break;
+        }
+        case property::kind_t::float_property:
+        {
+            float v = strtof(str, &end);
+            if (end == str || *end != '\0' || errno != 0) {
+                throw error::general_exception("expected a float value for " + path + ": " + value);
+            }
+            set_float(path, v);
+            break;
+        }
+        case property::kind_t::bool_property:
+            if (value == "true" || value == "1") {
+                set_bool(path, true);
+            }
+            else if (value == "false" || value == "0") {
+                set_bool(path, false);
+            }
+            else {
+                throw error::general_exception("expected true or false for " + path + ": " + value);
+            }
+            break;
+        default:
+            throw error::general_exception("can't set " + path);
+        }
+    }
+
+    buffer<unsigned char> save_patcher::write() const
+    {
+        return recompress_save(hdr_, *source_, dirty_chunks_);
+    }
+
+    void save_patcher::write(const std::string& outfile) const
+    {
+        buffer<unsigned char> b = write();
+        FILE *fp = fopen(outfile.c_str(), "wb");
+        if (fp == nullptr) {
+            throw error::general_exception("error opening output file " + outfile);
+        }
+        fwrite(b.buf.get(), 1, b.length, fp);
+        fclose(fp);
+    }
+}
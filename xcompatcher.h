@@ -0,0 +1,77 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMPATCHER_H
+#define XCOMPATCHER_H
+
+#include "xcom.h"
+#include "xcomselector.h"
+
+namespace xcom
+{
+    // Edits fixed-size property values (ints, floats, bools and object
+    // references) directly in the decompressed body of a save, without
+    // building the property tree. Since the size of the body doesn't
+    // change, only the compressed chunks containing an edit need to be
+    // recompressed when the save is written; all others are copied as-is.
+    //
+    // Properties are named by paths as described for property_selector,
+    // e.g. XGHeadQuarters.m_arrItems[172].
+    class save_patcher
+    {
+    public:
+        explicit save_patcher(buffer<unsigned char>&& save);
+        explicit save_patcher(const std::string& infile);
+
+        // The kind of the value at path: one of int_property, float_property,
+        // bool_property or object_property. Elements of number arrays are
+        // treated as ints and elements of object arrays as objects. Fields
+        // of native structs, e.g. XGStrategySoldier_3.m_vLoc.X, are ints or floats.
+        property::kind_t kind(const std::string& path) const;
+
+        // The value at path formatted as text, in the same form that set()
+        // accepts.
+        std::string get(const std::string& path) const;
+
+        void set_int(const std::string& path, int32_t value);
+        void set_float(const std::string& path, float value);
+        void set_bool(const std::string& path, bool value);
+        void set_object(const std::string& path, int32_t actor);
+
+        // Set the value at path from a string, interpreted according to the
+        // kind of the property: a number for ints, floats and objects (the
+        // actor index, or -1 for none), and true/false or 1/0 for bools.
+        void set(const std::string& path, const std::string& value);
+
+        // Build the patched save.
+        buffer<unsigned char> write() const;
+        void write(const std::string& outfile) const;
+
+    private:
+        value_location locate(const std::string& path) const;
+        void overwrite(const value_location& loc, const unsigned char *bytes);
+
+        header hdr_;
+        std::shared_ptr<save_source> source_;
+        checkpoint_chunk_table chunks_;
+        std::unique_ptr<checkpoint_index> index_;
+        std::vector<bool> dirty_chunks_;
+    };
+}
+#endif // XCOMPATCHER_H
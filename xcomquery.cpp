@@ -0,0 +1,107 @@
+
+#include "xcom.h"
+#include "xcomselector.h"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <locale>
+
+using namespace xcom;
+
+void usage(const char * name)
+{
+    printf("Usage: %s <in_file> <path> [<path> ...]\n", name);
+    printf("       %s -p <path> [-p <path> ...] <in_file> [<in_file> ...]\n", name);
+    printf("-p -- Look up these paths in each input file, printing a tab-separated line per file\n");
+    printf("Prints the value of each property, without converting the save to json.\n");
+    printf("Paths look like XGHeadQuarters.m_iCash or XGHeadQuarters.m_arrItems[172].\n");
+    printf("Objects are printed as the name of the actor they refer to.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> paths;
+    std::vector<std::string> files;
+    bool per_file = false;
+
+    if (argc <= 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setlocale(LC_ALL, "en_US.utf8");
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-p") == 0) {
+            if (argc <= (i+1)) {
+                usage(argv[0]);
+                return 1;
+            }
+            paths.push_back(argv[++i]);
+            per_file = true;
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    // Without -p the first argument is the save and the rest are paths.
+    if (!per_file && !files.empty()) {
+        paths.assign(files.begin() + 1, files.end());
+        files.resize(1);
+    }
+
+    if (files.empty() || paths.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        // Parse the paths once for all the files.
+        std::vector<property_selector> selectors;
+        for (const std::string& path : paths) {
+            selectors.emplace_back(path);
+        }
+
+        int result = 0;
+        for (const std::string& file : files) {
+            try {
+                save_query query{ file };
+                std::string line = per_file ? file : std::string{};
+                for (const property_selector& selector : selectors) {
+                    std::string value = query.get(selector).to_string();
+                    if (per_file) {
+                        line += "\t" + value;
+                    }
+                    else {
+                        printf("%s\n", value.c_str());
+                    }
+                }
+                if (per_file) {
+                    printf("%s\n", line.c_str());
+                }
+            }
+            catch (const error::xcom_exception& e) {
+                if (!per_file) {
+                    throw;
+                }
+                std::string message = e.what();
+                while (!message.empty() && message.back() == '\n') {
+                    message.pop_back();
+                }
+                fprintf(stderr, "%s: %s\n", file.c_str(), message.c_str());
+                result = 1;
+            }
+        }
+        return result;
+    }
+    catch (const error::xcom_exception& e) {
+        std::string message = e.what();
+        while (!message.empty() && message.back() == '\n') {
+            message.pop_back();
+        }
+        fprintf(stderr, "%s\n", message.c_str());
+        return 1;
+    }
+}
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "minilzo.h"
 #include "zlib.h"
 #include "xcomio.h"
+#include "xcomindex.h"
+#include "xcomstructs.h"
 #include "util.h"
 
 #include <string>
@@ -110,7 +112,7 @@ namespace xcom
 
             if(xcom_version::enemy_unknown == version)
             {
-                actors.push_back(build_actor_name_EU(actor_name, instance));
+                actors.add(actor_name, instance);
             }
             else
             {
@@ -124,7 +126,7 @@ namespace xcom
                     throw error::format_exception(r.offset(),
                             "malformed actor table entry: missing 0 instance");
                 }
-                actors.push_back(build_actor_name(package, actor_name, instance));
+                actors.add(package, actor_name, instance);
             }
         }
 
@@ -141,28 +143,11 @@ namespace xcom
                     inner_unknown);
         }
 
-        // Special case certain structs
-        if (struct_name.compare("Vector2D") == 0) {
+        // Native structs are stored as their raw data. See xcomstructs.h.
+        int32_t native_size = native_struct_size(struct_name);
+        if (native_size > 0) {
             return std::make_unique<struct_property>(name, struct_name,
-                    r.read_raw_bytes(8), 8);
-        }
-        else if (struct_name.compare("Vector") == 0) {
-            return std::make_unique<struct_property>(name, struct_name,
-                    r.read_raw_bytes(12), 12);
-        }
-        else if (struct_name.compare("Rotator") == 0) {
-            return std::make_unique<struct_property>(name, struct_name,
-                r.read_raw_bytes(12), 12);
-        }
-        else if (struct_name.compare("Box") == 0) {
-            // A "box" type. Unknown contents but always 25 bytes long
-            return std::make_unique<struct_property>(name, struct_name,
-                r.read_raw_bytes(25), 25);
-        }
-        else if (struct_name.compare("Color") == 0) {
-            // A Color type. Unknown contents (4 bytes)
-            return std::make_unique<struct_property>(name, struct_name,
-                r.read_raw_bytes(4), 4);
+                    r.read_raw_bytes(native_size), native_size);
         }
         else {
             property_list structProps = read_properties(r, version);
@@ -252,6 +237,18 @@ namespace xcom
     }
 
 
+    // The number of elements to reserve for an array: the bound, unless
+    // that's more elements than fit in the array's data, each taking at
+    // least min_size bytes. The bound comes from the save, so a corrupt one
+    // shouldn't cause a huge allocation.
+    static size_t plausible_element_count(int32_t array_bound, int32_t array_data_size, int32_t min_size)
+    {
+        if (array_bound <= 0) {
+            return 0;
+        }
+        return static_cast<size_t>(std::min(array_bound, array_data_size / min_size));
+    }
+
     property_ptr make_array_property(xcom_io &r, const std::string &name,
             int32_t property_size, xcom_version version)
     {
@@ -266,31 +263,34 @@ namespace xcom
             if (array_bound * 8 == array_data_size) {
                 // If the array data size is exactly 8x the array bound, we have an array of objects where
                 // each element is an actor id.
-                std::vector<int32_t> elements;
+                if (!r.bounds_check(array_data_size)) {
+                    throw error::format_exception(r.offset(), "object array: EOF");
+                }
+                array_elements elements(array_bound);
+                const unsigned char *data = r.pointer();
                 for (int32_t i = 0; i < array_bound; ++i) {
-                    int32_t actor1 = r.read_int();
-                    int32_t actor2 = r.read_int();
-                    if (actor1 == -1 && actor2 == -1) {
-                        elements.push_back(actor1);
+                    int32_t actors[2];
+                    le_load_array(actors, data + i * 8, 2);
+                    if (actors[0] == -1 && actors[1] == -1) {
+                        elements[i] = -1;
                     }
-                    else if (actor1 != (actor2 + 1)) {
-                        throw error::format_exception(r.offset(),
+                    else if (actors[0] != (actors[1] + 1)) {
+                        throw error::format_exception(r.offset() + (i + 1) * 8,
                             "expected related actor numbers in object array");
                     }
                     else {
-                        elements.push_back(actor1 / 2);
+                        elements[i] = actors[0] / 2;
                     }
                 }
+                r.seek(xcom_io::seek_kind::current, array_data_size);
                 return std::make_unique<object_array_property>(name, std::move(elements));
             }
             else if (array_bound * 4 == array_data_size) {
                 // If the array data size is exactly 4x the number of elements this is an array
                 // of numbers. We can't tell if they're ints or floats without looking at the UPK, though.
                 // Even guessing based on the numbers themselves is ambiguous for an array of all zeros.
-                std::vector<int32_t> elems;
-                for (int i = 0; i < array_bound; ++i) {
-                    elems.push_back(r.read_int());
-                }
+                array_elements elems(array_bound);
+                r.read_array(elems.data(), array_bound);
 
                 return std::make_unique<number_array_property>(name, std::move(elems));
             }
@@ -300,6 +300,7 @@ namespace xcom
                 case property::kind_t::struct_array_property:
                 {
                     std::vector<property_list> elements;
+                    elements.reserve(plausible_element_count(array_bound, array_data_size, 13));
                     for (int32_t i = 0; i < array_bound; ++i) {
                         elements.push_back(read_properties(r, version));
                     }
@@ -310,6 +311,7 @@ namespace xcom
                 case property::kind_t::enum_array_property:
                 {
                     std::vector<enum_value> elements;
+                    elements.reserve(plausible_element_count(array_bound, array_data_size, 8));
                     for (int32_t i = 0; i < array_bound; ++i) {
                         std::string name = r.read_string();
                         int32_t value = r.read_int();
@@ -321,6 +323,7 @@ namespace xcom
                 case property::kind_t::string_array_property:
                 {
                     std::vector<xcom_string> elements;
+                    elements.reserve(plausible_element_count(array_bound, array_data_size, 4));
                     for (int32_t i = 0; i < array_bound; ++i) {
                         elements.push_back(r.read_unicode_string());
                     }
@@ -354,13 +357,14 @@ namespace xcom
             }
 
             std::string prop_type = r.read_string();
-            int32_t unknown2 = r.read_int();
+            span_reader fields{ r, 12 };
+            int32_t unknown2 = fields.read_int();
             if (unknown2 != 0) {
-                throw error::format_exception(r.offset(),
+                throw error::format_exception(fields.offset(),
                         "read non-zero property unknown2 value: %x", unknown2);
             }
-            int32_t prop_size = r.read_int();
-            int32_t array_index = r.read_int();
+            int32_t prop_size = fields.read_int();
+            int32_t array_index = fields.read_int();
 
             property_ptr prop;
             if (prop_type.compare("ObjectProperty") == 0) {
@@ -373,8 +377,9 @@ namespace xcom
                 else
                 {
                     assert(prop_size == 8);
-                    int32_t actor1 = r.read_int();
-                    int32_t actor2 = r.read_int();
+                    span_reader actors{ r, 8 };
+                    int32_t actor1 = actors.read_int();
+                    int32_t actor2 = actors.read_int();
                     if (actor1 != -1 && actor1 != (actor2 + 1)) {
                         throw error::format_exception(r.offset(),
                                 "actor references in object property not related");
@@ -488,7 +493,58 @@ namespace xcom
         return properties;
     }
 
-    checkpoint_table read_checkpoint_table(xcom_io &r, xcom_version version)
+    // Read the property list of a checkpoint and any padding following it.
+    // The cursor must be at the start of the list, which is prop_length bytes
+    // long including the padding.
+    static void read_checkpoint_properties(xcom_io &r, checkpoint &chk, int32_t prop_length, xcom_version version)
+    {
+        chk.pad_size = 0;
+        size_t start_offset = r.offset();
+
+        chk.properties = read_properties(r, version);
+        if ((r.offset() - static_cast<int32_t>(start_offset)) < prop_length) {
+            chk.pad_size = static_cast<int32_t>(prop_length - (r.offset() - start_offset));
+
+            for (unsigned int i = 0; i < chk.pad_size; ++i) {
+                if (r.read_byte() != 0) {
+                    throw error::format_exception(r.offset(), "found non-zero padding byte");
+                }
+            }
+        }
+        size_t total_prop_size = 0;
+        std::for_each(chk.properties.begin(), chk.properties.end(),
+                [&total_prop_size](const property_ptr& prop) {
+                    total_prop_size += prop->full_size();
+                });
+
+        // length of trailing "None" to terminate the list + the unknown int.
+        total_prop_size += 9 + 4;
+        assert((uint32_t)prop_length == (total_prop_size + chk.pad_size));
+        chk.properties_loaded = true;
+    }
+
+    property_list& checkpoint::get_properties()
+    {
+        if (!properties_loaded) {
+            const save_source &src = *property_data.source;
+            xcom_io r{ src.data.buf.get(), src.data.length };
+            r.seek(xcom_io::seek_kind::start, property_data.offset);
+            read_checkpoint_properties(r, *this, static_cast<int32_t>(property_data.length), src.version);
+        }
+        return properties;
+    }
+
+    property_list& checkpoint::edit_properties()
+    {
+        dirty = true;
+        return get_properties();
+    }
+
+    // Read a checkpoint table. If source is non-null each checkpoint records
+    // the span of its properties in it, and if lazy is set the properties are
+    // skipped instead of being parsed.
+    checkpoint_table read_checkpoint_table(xcom_io &r, xcom_version version,
+        const std::shared_ptr<const save_source> &source, bool lazy)
     {
         checkpoint_table checkpoints;
         int32_t checkpoint_count = r.read_int();
@@ -497,39 +553,33 @@ namespace xcom
             checkpoint chk;
             chk.name = r.read_string();
             chk.instance_name = r.read_string();
-            chk.vector[0] = r.read_float();
-            chk.vector[1] = r.read_float();
-            chk.vector[2] = r.read_float();
-            chk.rotator[0] = r.read_int();
-            chk.rotator[1] = r.read_int();
-            chk.rotator[2] = r.read_int();
+            {
+                span_reader s{ r, 24 };
+                s.read_array(chk.vector.data(), 3);
+                s.read_array(chk.rotator.data(), 3);
+            }
             chk.class_name = r.read_string();
             int32_t prop_length = r.read_int();
             if (prop_length < 0) {
                 throw error::format_exception(r.offset(), "found negative property length");
             }
-            chk.pad_size = 0;
-            size_t start_offset = r.offset();
-
-            chk.properties = read_properties(r, version);
-            if ((r.offset() - static_cast<int32_t>(start_offset)) < prop_length) {
-                chk.pad_size = static_cast<int32_t>(prop_length - (r.offset() - start_offset));
 
-                for (unsigned int i = 0; i < chk.pad_size; ++i) {
-                    if (r.read_byte() != 0) {
-                        throw error::format_exception(r.offset(), "found non-zero padding byte");
-                    }
+            if (source != nullptr) {
+                if (!r.bounds_check(prop_length)) {
+                    throw error::format_exception(r.offset(), "property length extends past the end of the save");
                 }
+                chk.property_data = { source, static_cast<size_t>(r.offset()), static_cast<size_t>(prop_length) };
             }
-            size_t total_prop_size = 0;
-            std::for_each(chk.properties.begin(), chk.properties.end(),
-                    [&total_prop_size](const property_ptr& prop) {
-                        total_prop_size += prop->full_size();
-                    });
 
-            // length of trailing "None" to terminate the list + the unknown int.
-            total_prop_size += 9 + 4;
-            assert((uint32_t)prop_length == (total_prop_size + chk.pad_size));
+            if (lazy) {
+                // Just remember where the properties are and skip over them.
+                chk.pad_size = 0;
+                chk.properties_loaded = false;
+                r.seek(xcom_io::seek_kind::current, prop_length);
+            }
+            else {
+                read_checkpoint_properties(r, chk, prop_length, version);
+            }
             chk.template_index = r.read_int();
             checkpoints.push_back(std::move(chk));
         }
@@ -576,7 +626,8 @@ namespace xcom
         return names;
     }
 
-    checkpoint_chunk_table read_checkpoint_chunk_table(xcom_io &r, xcom_version version)
+    checkpoint_chunk_table read_checkpoint_chunk_table(xcom_io &r, xcom_version version,
+        const std::shared_ptr<const save_source> &source, bool lazy)
     {
         checkpoint_chunk_table checkpoints;
         std::vector<name_table> name_tables;
@@ -584,6 +635,7 @@ namespace xcom
         // Read the checkpoint chunks
         do {
             checkpoint_chunk chunk;
+            size_t chunk_start = r.offset();
             chunk.unknown_int1 = r.read_int();
             chunk.game_type = r.read_string();
             std::string none = r.read_string();
@@ -593,7 +645,7 @@ namespace xcom
             }
 
             chunk.unknown_int2 = r.read_int();
-            chunk.checkpoints = read_checkpoint_table(r, version);
+            chunk.checkpoints = read_checkpoint_table(r, version, source, lazy);
             int32_t name_table_length = r.read_int();
            // assert(name_table_length == 0);
             //TODO
@@ -610,6 +662,10 @@ namespace xcom
             chunk.map_name = r.read_string(); //unknown (map name)
             chunk.unknown_int4 = r.read_int(); //unknown  (checksum?)
 
+            if (source != nullptr) {
+                chunk.data = { source, chunk_start, r.offset() - chunk_start };
+            }
+
             checkpoints.push_back(std::move(chunk));
         } while (!r.eof());
 
@@ -627,20 +683,22 @@ namespace xcom
 
         do
         {
+            span_reader s{ r, 16 };
+
             // Expect the magic header value 0x9e2a83c1 at the start of each chunk
-            if (r.read_int() != UPK_Magic) {
-                throw error::format_exception(r.offset(),
+            if (s.read_int() != UPK_Magic) {
+                throw error::format_exception(s.offset(),
                         "failed to find compressed chunk header");
             }
 
             // Skip flags
-            (void)r.read_int();
+            (void)s.read_int();
 
             // Compressed size is at p+8
-            compressed_size = r.read_int();
+            compressed_size = s.read_int();
 
             // Uncompressed size is at p+12
-            uncompressed_size += r.read_int();
+            uncompressed_size += s.read_int();
 
             // Skip to next chunk: include the 8 bytes of header in this chunk we didn't
             // read (which sould be the compressed and uncompressed sizes repeated).
@@ -689,7 +747,7 @@ namespace xcom
         }
     }
 
-    buffer<unsigned char> decompress(xcom_io &r, xcom_version version)
+    buffer<unsigned char> decompress(xcom_io &r, xcom_version version, std::vector<compressed_chunk> *index)
     {
         int32_t total_uncompressed_size = calculate_uncompressed_size(r);
         if (total_uncompressed_size < 0) {
@@ -705,26 +763,35 @@ namespace xcom
 
         do
         {
+            size_t chunk_offset = r.offset();
+
+            span_reader s{ r, 16 };
+
             // Expect the magic header value 0x9e2a83c1 at the start of each chunk
-            if (r.read_int() != UPK_Magic) {
-                throw error::format_exception(r.offset(),
+            if (s.read_int() != UPK_Magic) {
+                throw error::format_exception(s.offset(),
                         "failed to find compressed chunk header");
             }
 
             // Skip unknown int (flags?)
-            (void)r.read_int();
+            (void)s.read_int();
 
             // Compressed size is at p+8
-            int32_t compressed_size = r.read_int();
+            int32_t compressed_size = s.read_int();
 
             // Uncompressed size is at p+12
-            int32_t uncompressed_size = r.read_int();
+            int32_t uncompressed_size = s.read_int();
             uint32_t decomp_size = decompress_one_chunk(version, r.pointer() + 8, compressed_size, outp, bytes_remaining);
             if (static_cast<int32_t>(decomp_size) != uncompressed_size)
             {
                 throw error::format_exception(r.offset(), "failed to decompress chunk");
             }
 
+            if (index != nullptr) {
+                index->push_back({ chunk_offset, compressed_size,
+                    static_cast<size_t>(outp - buf.get()), uncompressed_size });
+            }
+
             // Skip to next chunk - 24 bytes of this chunk header +
             // compressedSize bytes later.
             r.seek(xcom_io::seek_kind::current, compressed_size + 8);
@@ -762,31 +829,107 @@ namespace xcom
         return buffer;
     }
 
-    saved_game read_xcom_save(buffer<unsigned char>&& b)
+    // Read the header of a save and decompress its body. If index is non-null
+    // the location of each compressed chunk is recorded in it.
+    static buffer<unsigned char> read_body(xcom_io &rdr, header &hdr, std::vector<compressed_chunk> *index)
     {
-        saved_game save;
-
-        xcom_io rdr{ std::move(b) };
-        save.hdr = read_header(rdr);
-        if (save.hdr.tactical_save) {
+        hdr = read_header(rdr);
+        if (hdr.tactical_save) {
             throw xcom::error::general_exception("Saved games in tactical missions are not supported. Please try again with a geoscape save.");
         }
-        buffer<unsigned char> uncompressed_buf = decompress(rdr, static_cast<xcom_version>(save.hdr.version));
+        buffer<unsigned char> uncompressed_buf = decompress(rdr, static_cast<xcom_version>(hdr.version), index);
 #ifdef _DEBUG
         FILE *fp = fopen("output.dat", "wb");
         fwrite(uncompressed_buf.buf.get(), 1, uncompressed_buf.length, fp);
         fclose(fp);
 #endif
-        xcom_io uncompressed(std::move(uncompressed_buf));
-        save.actors = read_actor_table(uncompressed, save.hdr.version);
-        save.checkpoints = read_checkpoint_chunk_table(uncompressed, save.hdr.version);
+        return uncompressed_buf;
+    }
+
+    save_source read_save_source(buffer<unsigned char>&& b, header &hdr)
+    {
+        save_source source;
+        xcom_io rdr{ std::move(b) };
+        source.data = read_body(rdr, hdr, &source.chunks);
+        source.version = hdr.version;
+        source.compressed = rdr.release();
+        return source;
+    }
+
+    // Each checkpoint's properties are independent, and their spans are
+    // already known from reading the checkpoint table, so they can be parsed
+    // on several threads.
+    void load_properties(saved_game& save, unsigned threads)
+    {
+        std::vector<checkpoint*> pending;
+        for (checkpoint_chunk& chunk : save.checkpoints) {
+            for (checkpoint& chk : chunk.checkpoints) {
+                if (!chk.properties_loaded) {
+                    pending.push_back(&chk);
+                }
+            }
+        }
+
+        util::parallel_for(pending.size(), threads,
+            [&pending](size_t i) { pending[i]->get_properties(); });
+    }
+
+    // Forget where the checkpoints and chunks of a save came from.
+    static void release_source(saved_game& save)
+    {
+        for (checkpoint_chunk& chunk : save.checkpoints) {
+            chunk.data = {};
+            for (checkpoint& chk : chunk.checkpoints) {
+                chk.property_data = {};
+            }
+        }
+        save.source.reset();
+    }
+
+    saved_game read_xcom_save(buffer<unsigned char>&& b, const read_options &options)
+    {
+        saved_game save;
+        bool parallel = !options.lazy_properties && options.threads != 1;
+
+        if (options.lazy_properties || options.retain_source || parallel) {
+            // Checkpoints and chunks keep a reference to the decompressed
+            // data so they can parse their properties later or be written
+            // back verbatim.
+            std::shared_ptr<save_source> source =
+                std::make_shared<save_source>(read_save_source(std::move(b), save.hdr));
+
+            xcom_io uncompressed{ source->data.buf.get(), source->data.length };
+            save.actors = read_actor_table(uncompressed, save.hdr.version);
+            save.checkpoints = read_checkpoint_chunk_table(uncompressed, save.hdr.version,
+                source, options.lazy_properties || parallel);
+            save.source = source;
+
+            if (parallel) {
+                load_properties(save, options.threads);
+                if (!options.retain_source) {
+                    release_source(save);
+                }
+            }
+        }
+        else {
+            xcom_io rdr{ std::move(b) };
+            xcom_io uncompressed(read_body(rdr, save.hdr, nullptr));
+            save.actors = read_actor_table(uncompressed, save.hdr.version);
+            save.checkpoints = read_checkpoint_chunk_table(uncompressed, save.hdr.version, nullptr, false);
+        }
+
+        // Moving the save doesn't move its checkpoints, so the index stays
+        // valid when it's returned.
+        if (options.index_checkpoints) {
+            save.index = std::make_shared<checkpoint_index>(save);
+        }
 
         return save;
     }
 
-    saved_game read_xcom_save(const std::string &infile)
+    saved_game read_xcom_save(const std::string &infile, const read_options &options)
     {
-        return read_xcom_save(read_file(infile));
+        return read_xcom_save(read_file(infile), options);
     }
 
 } //namespace xcom
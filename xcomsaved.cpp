@@ -0,0 +1,531 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+/*
+xcomsaved - Serves save conversions over a Unix domain socket, so that
+callers don't pay process startup for every conversion.
+
+A client sends any number of requests on a connection, each a line of
+space-separated words:
+
+  <command> <input> [<argument> ...]
+
+where <input> is either @<path> naming a file the server reads, or the
+decimal length of the input data, which follows the line. Commands are:
+
+  to-json <save>                  Convert a save to json.
+  to-save <json>                  Convert json to a save.
+  validate <save>                 Check that a save can be read.
+  get <save> <path> ...           Read values, one per line (see xcomquery).
+  patch <save> <path>=<value> ... Set values and return the patched save.
+
+Each request gets a response line "ok <length>" or "error <length>",
+followed by that many bytes of output or error message. Error messages end
+with a newline.
+
+Each connection is read by a thread of its own, which does nothing but wait
+for requests. The requests themselves are handled by a fixed pool of worker
+threads, so idle connections don't hold up anyone else's. At most
+max_connections connections are open at once; further clients wait in the
+listen backlog until one closes.
+*/
+
+#include "xcom.h"
+#include "xcomio.h"
+#include "xcompatcher.h"
+#include "xcomselector.h"
+#include "jsonreader.h"
+#include "jsonwriter.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <locale>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace xcom;
+
+// Limits on what a client may send, so a bad request can't exhaust memory.
+static const size_t max_line_length = 64 * 1024;
+static const size_t max_input_length = 256 * 1024 * 1024;
+static const size_t max_connections = 1024;
+
+struct request_error : error::xcom_exception
+{
+    request_error(const std::string& s) : str_{s} {}
+    virtual std::string what() const noexcept { return str_; }
+
+private:
+    std::string str_;
+};
+
+// Buffered reads and writes on a connected socket.
+class connection
+{
+public:
+    explicit connection(int fd) : fd_{ fd } {}
+
+    ~connection()
+    {
+        close(fd_);
+    }
+
+    connection(const connection&) = delete;
+    connection& operator=(const connection&) = delete;
+
+    // Read a line, without the newline. Returns false at end of stream.
+    bool read_line(std::string& line)
+    {
+        line.clear();
+        for (;;) {
+            if (pos_ == buf_.size() && !fill()) {
+                if (!line.empty()) {
+                    throw request_error("connection closed in the middle of a request");
+                }
+                return false;
+            }
+
+            const char *start = buf_.data() + pos_;
+            const char *newline = static_cast<const char*>(memchr(start, '\n', buf_.size() - pos_));
+            size_t count = (newline != nullptr) ? newline - start : buf_.size() - pos_;
+            line.append(start, count);
+            pos_ += count;
+
+            if (line.size() > max_line_length) {
+                throw request_error("request line too long");
+            }
+            if (newline != nullptr) {
+                ++pos_;
+                return true;
+            }
+        }
+    }
+
+    buffer<unsigned char> read_bytes(size_t length)
+    {
+        buffer<unsigned char> b;
+        b.buf = std::make_unique<unsigned char[]>(length);
+        b.length = length;
+
+        size_t have = 0;
+        while (have < length) {
+            if (pos_ == buf_.size() && !fill()) {
+                throw request_error("connection closed in the middle of a request");
+            }
+            size_t count = std::min(length - have, buf_.size() - pos_);
+            memcpy(b.buf.get() + have, buf_.data() + pos_, count);
+            pos_ += count;
+            have += count;
+        }
+        return b;
+    }
+
+    // Send a response. Returns false if the client has gone away.
+    bool respond(bool ok, const unsigned char *data, size_t length)
+    {
+        std::string status = (ok ? "ok " : "error ") + std::to_string(length) + "\n";
+        return send_all(reinterpret_cast<const unsigned char*>(status.data()), status.size()) &&
+            send_all(data, length);
+    }
+
+    // Send an error response. Some exception messages end with a newline
+    // and some don't: make sure every error does.
+    bool respond_error(std::string message)
+    {
+        if (message.empty() || message.back() != '\n') {
+            message += '\n';
+        }
+        return respond(false, reinterpret_cast<const unsigned char*>(message.data()), message.size());
+    }
+
+private:
+    bool fill()
+    {
+        buf_.resize(64 * 1024);
+        ssize_t count;
+        do {
+            count = recv(fd_, &buf_[0], buf_.size(), 0);
+        } while (count < 0 && errno == EINTR);
+
+        buf_.resize(count > 0 ? count : 0);
+        pos_ = 0;
+        return count > 0;
+    }
+
+    bool send_all(const unsigned char *data, size_t length)
+    {
+        while (length > 0) {
+            ssize_t count = send(fd_, data, length, MSG_NOSIGNAL);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                return false;
+            }
+            data += count;
+            length -= count;
+        }
+        return true;
+    }
+
+    int fd_;
+    std::string buf_;
+    size_t pos_ = 0;
+};
+
+static std::vector<std::string> split_words(const std::string& line)
+{
+    std::vector<std::string> words;
+    std::istringstream stream{ line };
+    std::string word;
+    while (stream >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+static bool is_command(const std::string& command)
+{
+    return command == "to-json" || command == "to-save" || command == "validate" ||
+        command == "get" || command == "patch";
+}
+
+static bool is_file_input(const std::string& input)
+{
+    return input.size() > 1 && input[0] == '@';
+}
+
+// Read input data sent on the connection after the request line.
+static buffer<unsigned char> read_input(connection& conn, const std::string& input)
+{
+    char *end;
+    unsigned long long length = strtoull(input.c_str(), &end, 10);
+    if (end == input.c_str() || *end != '\0' || input[0] == '-') {
+        throw request_error("expected @<path> or a length for the input: " + input);
+    }
+    if (length > max_input_length) {
+        throw request_error("input too large");
+    }
+    return conn.read_bytes(static_cast<size_t>(length));
+}
+
+static buffer<unsigned char> string_buffer(const std::string& str)
+{
+    buffer<unsigned char> b;
+    b.buf = std::make_unique<unsigned char[]>(str.size());
+    b.length = str.size();
+    memcpy(b.buf.get(), str.data(), str.size());
+    return b;
+}
+
+static buffer<unsigned char> handle(const std::vector<std::string>& words, buffer<unsigned char>&& input)
+{
+    const std::string& command = words[0];
+
+    if (command == "to-json") {
+        saved_game save = read_xcom_save(std::move(input));
+        std::ostringstream out;
+        json_writer w{ out };
+        buildJson(save, w);
+        return string_buffer(out.str());
+    }
+    else if (command == "to-save") {
+        saved_game save = build_save(std::string(reinterpret_cast<const char*>(input.buf.get()), input.length));
+        return write_xcom_save(save);
+    }
+    else if (command == "validate") {
+        saved_game save = read_xcom_save(std::move(input));
+        size_t checkpoints = 0;
+        for (const checkpoint_chunk& chunk : save.checkpoints) {
+            checkpoints += chunk.checkpoints.size();
+        }
+        return string_buffer("version " + std::to_string(static_cast<int>(save.hdr.version)) + ", " +
+            std::to_string(save.checkpoints.size()) + " chunks, " +
+            std::to_string(checkpoints) + " checkpoints\n");
+    }
+    else if (command == "get") {
+        save_query query{ std::move(input) };
+        std::string out;
+        for (size_t i = 2; i < words.size(); ++i) {
+            out += query.get(words[i]).to_string() + "\n";
+        }
+        return string_buffer(out);
+    }
+    else if (command == "patch") {
+        save_patcher patcher{ std::move(input) };
+        for (size_t i = 2; i < words.size(); ++i) {
+            size_t eq = words[i].find('=');
+            if (eq == std::string::npos) {
+                throw request_error("expected <path>=<value>: " + words[i]);
+            }
+            patcher.set(words[i].substr(0, eq), words[i].substr(eq + 1));
+        }
+        return patcher.write();
+    }
+
+    throw request_error("unknown command: " + command);
+}
+
+// Requests waiting for a worker thread.
+class job_queue
+{
+public:
+    void push(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            jobs_.push_back(std::move(job));
+        }
+        ready_.notify_one();
+    }
+
+    std::function<void()> pop()
+    {
+        std::unique_lock<std::mutex> lock{ mutex_ };
+        ready_.wait(lock, [this]() { return !jobs_.empty(); });
+        std::function<void()> job = std::move(jobs_.front());
+        jobs_.pop_front();
+        return job;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::function<void()>> jobs_;
+};
+
+// Read requests from a connection until it closes, handing each to a worker
+// and waiting for its output. Runs on the connection's own thread.
+static void serve(int fd, job_queue& workers)
+{
+    connection conn{ fd };
+    std::string line;
+
+    try {
+        while (conn.read_line(line)) {
+            std::vector<std::string> words = split_words(line);
+            if (words.size() < 2) {
+                if (!conn.respond_error("expected <command> <input> [<argument> ...]")) {
+                    return;
+                }
+                continue;
+            }
+
+            // Input sent on the connection has to be consumed even if the
+            // command fails, to stay in step with the client, so read it
+            // first. Failing to read it leaves us out of step.
+            buffer<unsigned char> input;
+            bool from_file = is_file_input(words[1]);
+            if (!from_file) {
+                input = read_input(conn, words[1]);
+            }
+
+            if (!is_command(words[0])) {
+                if (!conn.respond_error("unknown command: " + words[0])) {
+                    return;
+                }
+                continue;
+            }
+
+            // This thread waits for the worker, so the job can use our
+            // locals by reference.
+            bool ok = true;
+            buffer<unsigned char> output;
+            std::string message;
+            std::promise<void> done;
+            workers.push([&]() {
+                try {
+                    if (from_file) {
+                        input = read_file(words[1].substr(1));
+                    }
+                    output = handle(words, std::move(input));
+                }
+                catch (const error::xcom_exception& e) {
+                    ok = false;
+                    message = e.what();
+                }
+                catch (const std::exception& e) {
+                    ok = false;
+                    message = e.what();
+                }
+                done.set_value();
+            });
+            done.get_future().wait();
+
+            bool sent = ok ? conn.respond(true, output.buf.get(), output.length) : conn.respond_error(message);
+            if (!sent) {
+                return;
+            }
+        }
+    }
+    catch (const error::xcom_exception& e) {
+        // The connection is out of step or broken: report it and give up on it.
+        conn.respond_error(e.what());
+    }
+    catch (const std::exception& e) {
+        // E.g. out of memory reading the input. This thread is detached, so
+        // nothing may escape it: that would take down the whole server.
+        conn.respond_error(e.what());
+    }
+}
+
+// Counts open connections, making accept wait while there are too many.
+class connection_limit
+{
+public:
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock{ mutex_ };
+        available_.wait(lock, [this]() { return open_ < max_connections; });
+        ++open_;
+    }
+
+    void release()
+    {
+        {
+            std::lock_guard<std::mutex> lock{ mutex_ };
+            --open_;
+        }
+        available_.notify_one();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable available_;
+    size_t open_ = 0;
+};
+
+void usage(const char * name)
+{
+    printf("Usage: %s [-j <threads>] <socket_path>\n", name);
+    printf("-j -- Number of requests to handle at once, defaults to one per core\n");
+}
+
+int main(int argc, char *argv[])
+{
+    std::string socket_path;
+    unsigned threads = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0) {
+            if (argc <= (i+1)) {
+                usage(argv[0]);
+                return 1;
+            }
+            threads = static_cast<unsigned>(atoi(argv[++i]));
+        }
+        else if (socket_path.empty()) {
+            socket_path = argv[i];
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (socket_path.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    setlocale(LC_ALL, "en_US.utf8");
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof addr.sun_path) {
+        fprintf(stderr, "Error: socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    // Replace the socket left behind by a previous run.
+    unlink(socket_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0) {
+        perror("bind");
+        return 1;
+    }
+    if (listen(listen_fd, SOMAXCONN) != 0) {
+        perror("listen");
+        return 1;
+    }
+
+    // Workers live for the life of the server, so each keeps its codec
+    // state (LZO work memory, iconv descriptors) warm across requests.
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    job_queue queue;
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back([&queue]() {
+            for (;;) {
+                queue.pop()();
+            }
+        });
+    }
+
+    connection_limit limit;
+    for (;;) {
+        limit.acquire();
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            limit.release();
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            exit(1);
+        }
+
+        try {
+            std::thread([fd, &queue, &limit]() {
+                serve(fd, queue);
+                limit.release();
+            }).detach();
+        }
+        catch (const std::system_error&) {
+            // Out of threads: turn this client away rather than stop.
+            close(fd);
+            limit.release();
+        }
+    }
+}
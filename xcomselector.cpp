@@ -0,0 +1,475 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+/*
+xcomselector.cpp - Point queries on the raw property stream of a save.
+*/
+
+#include "xcomselector.h"
+#include "xcomio.h"
+#include "xcomstructs.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string_view>
+
+namespace xcom
+{
+    namespace
+    {
+        // A cursor over the decompressed body of a save that reads property
+        // headers without copying or converting their strings. Property and
+        // type names are plain ASCII, so they can be compared as they are.
+        struct raw_cursor
+        {
+            const unsigned char *data;
+            size_t length;
+            size_t offset;
+
+            void check(size_t count) const
+            {
+                if (count > length - offset) {
+                    throw error::format_exception(offset, "unexpected end of property data");
+                }
+            }
+
+            int32_t read_int()
+            {
+                check(4);
+                int32_t v = le_load<int32_t>(data + offset);
+                offset += 4;
+                return v;
+            }
+
+            std::string_view read_name()
+            {
+                int32_t count = read_int();
+                if (count == 0) {
+                    return{};
+                }
+                if (count < 0) {
+                    throw error::format_exception(offset, "found UTF-16 string in unexpected location");
+                }
+                check(count);
+                // The stored length counts the trailing null.
+                std::string_view name{ reinterpret_cast<const char*>(data + offset), static_cast<size_t>(count - 1) };
+                offset += count;
+                return name;
+            }
+        };
+
+        // A property header read from the raw property stream.
+        struct raw_property
+        {
+            std::string_view name;
+            std::string_view type;
+            int32_t size;
+            int32_t array_index;
+
+            // The struct name of a struct property or the enum type of a byte
+            // property. Empty for other kinds.
+            std::string_view inner_type;
+
+            // The offsets of the property's value and of the end of the
+            // property in the decompressed body.
+            size_t value_offset;
+            size_t end_offset;
+        };
+
+        // Read the next property header and skip over its value. Returns false
+        // if this is the "None" property ending the list.
+        bool read_raw_property(raw_cursor &r, raw_property &prop)
+        {
+            prop.name = r.read_name();
+            (void)r.read_int();
+            if (prop.name == "None") {
+                return false;
+            }
+
+            prop.type = r.read_name();
+            (void)r.read_int();
+            prop.size = r.read_int();
+            prop.array_index = r.read_int();
+
+            // Struct and byte properties have a type name ahead of the value,
+            // which isn't counted in the property size.
+            prop.inner_type = {};
+            if (prop.type == "StructProperty" || prop.type == "ByteProperty") {
+                prop.inner_type = r.read_name();
+                (void)r.read_int();
+            }
+
+            // Bool properties report a size of 0 but have a 1 byte value.
+            int32_t value_size = (prop.type == "BoolProperty") ? 1 : prop.size;
+            if (value_size < 0 || static_cast<size_t>(value_size) > r.length - r.offset) {
+                throw error::format_exception(r.offset, "invalid size for property %s",
+                    std::string(prop.name).c_str());
+            }
+
+            prop.value_offset = r.offset;
+            prop.end_offset = prop.value_offset + value_size;
+            r.offset = prop.end_offset;
+            return true;
+        }
+
+        void skip_property_list(raw_cursor &r)
+        {
+            raw_property prop;
+            while (read_raw_property(r, prop)) {}
+        }
+
+        // Find the value named by segments[first..] in the data of a native
+        // struct at offset.
+        value_location locate_native_field(std::string_view struct_name, size_t offset,
+            const std::vector<property_selector::segment>& segments, size_t first, const std::string& path)
+        {
+            for (size_t i = first; i < segments.size(); ++i) {
+                const property_selector::segment &seg = segments[i];
+                native_field field;
+                if (seg.has_index || !find_native_field(struct_name, seg.name, field)) {
+                    throw error::general_exception("property not found: " + path);
+                }
+
+                offset += field.offset;
+                if (field.struct_name.empty()) {
+                    if (i != segments.size() - 1) {
+                        throw error::general_exception("can't look for members of " + seg.name + " in " + path);
+                    }
+                    property::kind_t kind = field.is_float ? property::kind_t::float_property : property::kind_t::int_property;
+                    return{ kind, offset, static_cast<size_t>(field.size) };
+                }
+                struct_name = field.struct_name;
+            }
+
+            throw error::general_exception(path + " is a " + std::string(struct_name) + ", not a single value");
+        }
+    }
+
+    property_selector::property_selector(const std::string& path) :
+        path_(path)
+    {
+        size_t start = 0;
+
+        for (;;) {
+            size_t end = path.find('.', start);
+            std::string part = path.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            segment seg{ part, 0, false };
+
+            size_t bracket = part.find('[');
+            if (bracket != std::string::npos) {
+                char *index_end;
+                errno = 0;
+                long index = strtol(part.c_str() + bracket + 1, &index_end, 10);
+                if (index_end == part.c_str() + bracket + 1 || *index_end != ']' ||
+                        index_end[1] != '\0' || index < 0 || errno != 0) {
+                    throw error::general_exception("invalid index in property path: " + path);
+                }
+                seg.name = part.substr(0, bracket);
+                seg.index = static_cast<int32_t>(index);
+                seg.has_index = true;
+            }
+
+            if (seg.name.empty()) {
+                throw error::general_exception("invalid property path: " + path);
+            }
+            segments_.push_back(seg);
+
+            if (end == std::string::npos) {
+                break;
+            }
+            start = end + 1;
+        }
+
+        if (segments_.size() < 2) {
+            throw error::general_exception("property path needs a checkpoint and a property name: " + path);
+        }
+        if (segments_[0].has_index) {
+            throw error::general_exception("unexpected index on checkpoint name " + segments_[0].name);
+        }
+    }
+
+    const checkpoint& find_checkpoint(const checkpoint_chunk_table& chunks, const property_selector& selector)
+    {
+        const std::string& name = selector.segments()[0].name;
+        const checkpoint *by_class = nullptr;
+        for (const checkpoint_chunk &chunk : chunks) {
+            for (const checkpoint &chk : chunk.checkpoints) {
+                if (chk.instance_name == name) {
+                    return chk;
+                }
+
+                if (by_class == nullptr) {
+                    size_t dot = chk.class_name.find_last_of('.');
+                    size_t start = (dot == std::string::npos) ? 0 : dot + 1;
+                    if (chk.class_name.compare(start, std::string::npos, name) == 0) {
+                        by_class = &chk;
+                    }
+                }
+            }
+        }
+
+        if (by_class == nullptr) {
+            throw error::general_exception("no checkpoint named " + name);
+        }
+        return *by_class;
+    }
+
+    const checkpoint& find_checkpoint(const checkpoint_index& index, const property_selector& selector)
+    {
+        const std::string& name = selector.segments()[0].name;
+        const checkpoint *chk = index.find(name);
+        if (chk == nullptr) {
+            const std::vector<checkpoint*>& of_class = index.find_class(name);
+            if (of_class.empty()) {
+                throw error::general_exception("no checkpoint named " + name);
+            }
+            chk = of_class.front();
+        }
+        return *chk;
+    }
+
+    value_location locate_value(const checkpoint& chk, const property_selector& selector)
+    {
+        const std::string& path = selector.path();
+        const std::vector<property_selector::segment>& segments = selector.segments();
+
+        if (chk.property_data.empty()) {
+            throw error::general_exception("no property data for checkpoint " + chk.instance_name);
+        }
+        const save_source& source = *chk.property_data.source;
+        raw_cursor r{ source.data.buf.get(), source.data.length, chk.property_data.offset };
+
+        for (size_t i = 1; i < segments.size(); ++i) {
+            const property_selector::segment &seg = segments[i];
+            bool last = (i == segments.size() - 1);
+
+            // Find the property in the list at the cursor. A dynamic array
+            // element is an index into an array property, a static array
+            // element is a property with a matching array index. Check for
+            // the array property first: its array index is 0, so it would
+            // otherwise be taken for element 0 of a static array.
+            raw_property prop;
+            bool found = false;
+            bool dynamic_element = false;
+            while (read_raw_property(r, prop)) {
+                if (prop.name != seg.name) {
+                    continue;
+                }
+                if (seg.has_index && prop.type == "ArrayProperty") {
+                    found = true;
+                    dynamic_element = true;
+                    break;
+                }
+                if (prop.array_index == seg.index) {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found) {
+                throw error::general_exception("property not found: " + path);
+            }
+
+            if (dynamic_element) {
+                r.offset = prop.value_offset;
+                int32_t array_bound = r.read_int();
+                if (seg.index >= array_bound) {
+                    throw error::general_exception("array index out of range: " + path);
+                }
+
+                if (last) {
+                    size_t data_offset = prop.value_offset + 4;
+                    if (prop.size == 4 + 4 * array_bound) {
+                        return{ property::kind_t::int_property, data_offset + 4 * seg.index, 4 };
+                    }
+                    else if (prop.size == 4 + 8 * array_bound) {
+                        return{ property::kind_t::object_property, data_offset + 8 * seg.index, 8 };
+                    }
+                    throw error::general_exception("not an array of numbers or objects: " + path);
+                }
+
+                // Anything else must be an array of structs: skip to the
+                // requested element.
+                for (int32_t elem = 0; elem < seg.index; ++elem) {
+                    skip_property_list(r);
+                }
+                continue;
+            }
+
+            if (last) {
+                size_t value_size = prop.end_offset - prop.value_offset;
+                property::kind_t kind;
+                if (prop.type == "IntProperty") {
+                    kind = property::kind_t::int_property;
+                }
+                else if (prop.type == "FloatProperty") {
+                    kind = property::kind_t::float_property;
+                }
+                else if (prop.type == "BoolProperty") {
+                    kind = property::kind_t::bool_property;
+                }
+                else if (prop.type == "ObjectProperty") {
+                    kind = property::kind_t::object_property;
+                }
+                else if (prop.type == "StrProperty") {
+                    kind = property::kind_t::string_property;
+                }
+                else if (prop.type == "NameProperty") {
+                    kind = property::kind_t::name_property;
+                }
+                else if (prop.type == "ByteProperty") {
+                    kind = property::kind_t::enum_property;
+                }
+                else {
+                    throw error::general_exception(path + " is a " + std::string(prop.type) + ", not a single value");
+                }
+                return{ kind, prop.value_offset, value_size };
+            }
+
+            if (prop.type != "StructProperty") {
+                throw error::general_exception("can't look for members of " + std::string(prop.type) +
+                    " " + seg.name + " in " + path);
+            }
+
+            // Native structs have no property list: the rest of the path
+            // names fields of their raw data. See xcomstructs.h.
+            if (native_struct_size(prop.inner_type) > 0) {
+                if (prop.end_offset - prop.value_offset != static_cast<size_t>(native_struct_size(prop.inner_type))) {
+                    throw error::format_exception(prop.value_offset, "unexpected size for %s %s",
+                        std::string(prop.inner_type).c_str(), std::string(prop.name).c_str());
+                }
+                return locate_native_field(prop.inner_type, prop.value_offset, segments, i + 1, path);
+            }
+            r.offset = prop.value_offset;
+        }
+
+        // Not reached: the last segment always returns or throws.
+        throw error::general_exception("property not found: " + path);
+    }
+
+    property_value read_value(const save_source& source, const value_location& loc,
+        const actor_table *actors)
+    {
+        xcom_io r{ source.data.buf.get(), source.data.length };
+        r.seek(xcom_io::seek_kind::start, loc.offset);
+
+        property_value v;
+        v.kind = loc.kind;
+        switch (loc.kind)
+        {
+        case property::kind_t::int_property:
+            // Single byte ints are fields of native structs, e.g. a Color.
+            v.int_value = (loc.size == 1) ? r.read_byte() : r.read_int();
+            break;
+        case property::kind_t::float_property:
+            v.float_value = r.read_float();
+            break;
+        case property::kind_t::bool_property:
+            v.int_value = r.read_byte() != 0 ? 1 : 0;
+            break;
+        case property::kind_t::object_property:
+            // Objects are stored as a single actor number in EU, and in EW
+            // (and in arrays) as a related pair of numbers: see
+            // read_properties.
+            v.int_value = r.read_int();
+            if (loc.size != 4 && v.int_value != -1) {
+                v.int_value /= 2;
+            }
+            if (actors != nullptr && v.int_value >= 0 && static_cast<size_t>(v.int_value) < actors->size()) {
+                v.string_value = (*actors)[v.int_value];
+            }
+            break;
+        case property::kind_t::string_property:
+            v.string_value = r.read_unicode_string().str;
+            break;
+        case property::kind_t::name_property:
+            v.string_value = r.read_string();
+            v.int_value = r.read_int();
+            break;
+        case property::kind_t::enum_property:
+            // A byte property with no enum type is a single raw byte.
+            if (loc.size == 1) {
+                v.string_value = "None";
+                v.int_value = r.read_byte();
+            }
+            else {
+                v.string_value = r.read_string();
+                v.int_value = r.read_int();
+            }
+            break;
+        default:
+            throw error::general_exception("can't read a value of kind " + property_kind_to_string(loc.kind));
+        }
+        return v;
+    }
+
+    std::string property_value::to_string() const
+    {
+        switch (kind)
+        {
+        case property::kind_t::int_property:
+            return std::to_string(int_value);
+        case property::kind_t::float_property:
+        {
+            // Enough digits that the text reads back as the same float.
+            std::ostringstream stream;
+            stream.precision(std::numeric_limits<float>::max_digits10);
+            stream << float_value;
+            return stream.str();
+        }
+        case property::kind_t::bool_property:
+            return int_value != 0 ? "true" : "false";
+        case property::kind_t::object_property:
+            return string_value.empty() ? std::to_string(int_value) : string_value;
+        default:
+            return string_value;
+        }
+    }
+
+    save_query::save_query(buffer<unsigned char>&& save)
+    {
+        std::shared_ptr<save_source> source = std::make_shared<save_source>(read_save_source(std::move(save), hdr_));
+        source_ = source;
+
+        // Find the checkpoints but don't parse any of their properties.
+        xcom_io r{ source->data.buf.get(), source->data.length };
+        actors_ = read_actor_table(r, hdr_.version);
+        chunks_ = read_checkpoint_chunk_table(r, hdr_.version, source_, true);
+        index_ = std::make_unique<checkpoint_index>(chunks_, actors_);
+    }
+
+    save_query::save_query(const std::string& infile) :
+        save_query(read_file(infile))
+    {
+    }
+
+    property_value save_query::get(const property_selector& selector) const
+    {
+        const checkpoint& chk = find_checkpoint(*index_, selector);
+        return read_value(*source_, locate_value(chk, selector), &actors_);
+    }
+
+    property_value save_query::get(const std::string& path) const
+    {
+        return get(property_selector{ path });
+    }
+}
@@ -0,0 +1,145 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMSELECTOR_H
+#define XCOMSELECTOR_H
+
+#include "xcom.h"
+#include "xcomindex.h"
+
+namespace xcom
+{
+    // A property path, parsed once so it can be used for any number of
+    // queries. Paths have the form
+    //
+    //   <checkpoint>.<property>[.<property>...]
+    //
+    // where <checkpoint> is either the instance name of a checkpoint (e.g.
+    // XGStrategy_0) or the unqualified name of its class (e.g. XGStrategy),
+    // which selects the first checkpoint of that class. Struct members are
+    // named by following the struct property with the member name. Any
+    // property may be followed by an index in brackets: for static arrays
+    // this selects the element with that array index, for dynamic arrays of
+    // numbers or objects it selects that element, and for dynamic arrays of
+    // structs it selects the struct to look in for the next name. Fields of
+    // structs the game stores natively (see xcomstructs.h) are named the
+    // same way, e.g. the X of a Vector. E.g.
+    //
+    //   XGHeadQuarters.m_arrItems[172]
+    //   XGStrategySoldier_3.m_kChar.aStats[1]
+    //   XGStrategySoldier_3.m_vLoc.X
+    class property_selector
+    {
+    public:
+        explicit property_selector(const std::string& path);
+
+        struct segment
+        {
+            std::string name;
+            int32_t index;
+            bool has_index;
+        };
+
+        const std::string& path() const {
+            return path_;
+        }
+
+        // The checkpoint name followed by one segment per property.
+        const std::vector<segment>& segments() const {
+            return segments_;
+        }
+
+    private:
+        std::string path_;
+        std::vector<segment> segments_;
+    };
+
+    // Where a selected value is in the decompressed body of a save. The kind
+    // is one of int, float, bool, object, string, name or enum; elements of
+    // number arrays are ints and elements of object arrays are objects.
+    // Fields of native structs are ints or floats, and byte sized ints are
+    // unsigned.
+    // Objects are 4 bytes in EU saves and 8 bytes in EW saves and arrays.
+    struct value_location
+    {
+        property::kind_t kind;
+        size_t offset;
+        size_t size;
+    };
+
+    // Find the checkpoint named by the first segment of a selector.
+    const checkpoint& find_checkpoint(const checkpoint_chunk_table& chunks, const property_selector& selector);
+    const checkpoint& find_checkpoint(const checkpoint_index& index, const property_selector& selector);
+
+    // Find the value a selector names in the serialized properties of a
+    // checkpoint read with retain_source or lazy_properties. Only property
+    // headers along the way are read: the values of all other properties are
+    // skipped using their stored sizes, without parsing them.
+    value_location locate_value(const checkpoint& chk, const property_selector& selector);
+
+    // A value read by a query.
+    struct property_value
+    {
+        property::kind_t kind;
+
+        // Ints, bools (0 or 1), objects (the actor index, or -1 for none),
+        // and the numbers of names and enums.
+        int32_t int_value = 0;
+
+        float float_value = 0.0f;
+
+        // Strings, the names of names and enum values, and the names of
+        // actors referred to by objects.
+        std::string string_value;
+
+        // The value as text: the actor name for an object, if it has one.
+        std::string to_string() const;
+    };
+
+    // Read a value found by locate_value(). Object values are looked up in
+    // actors, if given.
+    property_value read_value(const save_source& source, const value_location& loc,
+        const actor_table *actors);
+
+    // Answers point queries on a save without building its property tree.
+    // Only the checkpoint list is read up front; each query walks just the
+    // properties of the checkpoint it names.
+    class save_query
+    {
+    public:
+        explicit save_query(buffer<unsigned char>&& save);
+        explicit save_query(const std::string& infile);
+
+        const header& hdr() const {
+            return hdr_;
+        }
+
+        property_value get(const property_selector& selector) const;
+        property_value get(const std::string& path) const;
+
+    private:
+        header hdr_;
+        std::shared_ptr<const save_source> source_;
+        actor_table actors_;
+        checkpoint_chunk_table chunks_;
+        std::unique_ptr<checkpoint_index> index_;
+    };
+}
+
+#endif // XCOMSELECTOR_H
@@ -0,0 +1,763 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#include "xcomsnapshot.h"
+#include "xcomio.h"
+
+#include <cstring>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace xcom
+{
+    using namespace snapshot_format;
+
+    // The size of one record in each section.
+    static const size_t record_sizes[section_count] = {
+        sizeof(string_entry),
+        1,
+        sizeof(uint32_t),
+        sizeof(chunk_record),
+        sizeof(checkpoint_record),
+        sizeof(property_record),
+        sizeof(list_record),
+        sizeof(int32_t),
+        1
+    };
+
+    // Every record is made up of 32-bit fields, which are stored in the file
+    // in little-endian order. The header's magic is the one exception: it's
+    // four bytes, stored as they are.
+    template <typename T>
+    static void store_record(unsigned char *p, const T& rec)
+    {
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0, "snapshot records must be made of 32-bit fields");
+        uint32_t fields[sizeof(T) / sizeof(uint32_t)];
+        memcpy(fields, &rec, sizeof rec);
+        le_store_array(p, fields, sizeof(T) / sizeof(uint32_t));
+    }
+
+    template <typename T>
+    static T load_record(const unsigned char *p)
+    {
+        static_assert(sizeof(T) % sizeof(uint32_t) == 0, "snapshot records must be made of 32-bit fields");
+        uint32_t fields[sizeof(T) / sizeof(uint32_t)];
+        le_load_array(fields, p, sizeof(T) / sizeof(uint32_t));
+        T rec;
+        memcpy(&rec, fields, sizeof rec);
+        return rec;
+    }
+
+    // Store a section's records at p. A single copy for byte sections, or on
+    // a little-endian host.
+    template <typename T>
+    static void store_section(unsigned char *p, const std::vector<T>& records)
+    {
+        if (records.empty()) {
+            return;
+        }
+        if constexpr (sizeof(T) > 1) {
+            if (!host_is_little_endian) {
+                for (size_t i = 0; i < records.size(); ++i) {
+                    store_record(p + i * sizeof(T), records[i]);
+                }
+                return;
+            }
+        }
+        memcpy(p, records.data(), records.size() * sizeof(T));
+    }
+
+    static error::general_exception invalid_snapshot(const std::string& why)
+    {
+        return error::general_exception("invalid snapshot: " + why);
+    }
+
+    class snapshot_writer
+    {
+    public:
+        buffer<unsigned char> write(saved_game& save)
+        {
+            file_header hdr;
+            memset(&hdr, 0, sizeof hdr);
+            memcpy(hdr.magic, magic, sizeof magic);
+            hdr.format_version = current_version;
+
+            hdr.version = static_cast<uint32_t>(save.hdr.version);
+            hdr.uncompressed_size = save.hdr.uncompressed_size;
+            hdr.game_number = save.hdr.game_number;
+            hdr.save_number = save.hdr.save_number;
+            hdr.save_description = intern(save.hdr.save_description.str);
+            hdr.save_description_is_wide = save.hdr.save_description.is_wide;
+            hdr.time = intern(save.hdr.time.str);
+            hdr.time_is_wide = save.hdr.time.is_wide;
+            hdr.map_command = intern(save.hdr.map_command);
+            hdr.tactical_save = save.hdr.tactical_save;
+            hdr.ironman = save.hdr.ironman;
+            hdr.autosave = save.hdr.autosave;
+            hdr.dlc = intern(save.hdr.dlc);
+            hdr.language = intern(save.hdr.language);
+            hdr.profile_number = save.hdr.profile_number;
+            hdr.profile_date = intern(save.hdr.profile_date.str);
+            hdr.profile_date_is_wide = save.hdr.profile_date.is_wide;
+
+            for (const std::string& actor : save.actors) {
+                actors_.push_back(intern(actor));
+            }
+            hdr.global_actor_count = static_cast<uint32_t>(save.actors.size());
+
+            for (checkpoint_chunk& chunk : save.checkpoints) {
+                chunk_record rec;
+                rec.unknown_int1 = chunk.unknown_int1;
+                rec.game_type = intern(chunk.game_type);
+                rec.unknown_int2 = chunk.unknown_int2;
+                rec.class_name = intern(chunk.class_name);
+                rec.unknown_int3 = chunk.unknown_int3;
+                rec.display_name = intern(chunk.display_name);
+                rec.map_name = intern(chunk.map_name);
+                rec.unknown_int4 = chunk.unknown_int4;
+
+                rec.first_actor = static_cast<uint32_t>(actors_.size());
+                rec.actor_count = static_cast<uint32_t>(chunk.actors.size());
+                for (const std::string& actor : chunk.actors) {
+                    actors_.push_back(intern(actor));
+                }
+
+                rec.first_checkpoint = static_cast<uint32_t>(checkpoints_.size());
+                rec.checkpoint_count = static_cast<uint32_t>(chunk.checkpoints.size());
+                for (checkpoint& chk : chunk.checkpoints) {
+                    checkpoint_record crec;
+                    crec.name = intern(chk.name);
+                    crec.instance_name = intern(chk.instance_name);
+                    crec.class_name = intern(chk.class_name);
+                    std::copy(chk.vector.begin(), chk.vector.end(), crec.vector);
+                    std::copy(chk.rotator.begin(), chk.rotator.end(), crec.rotator);
+
+                    // Parse lazily read properties first: that's also what
+                    // determines the pad size.
+                    list_record props = write_list(chk.get_properties());
+                    crec.template_index = chk.template_index;
+                    crec.pad_size = chk.pad_size;
+                    crec.first_property = props.first;
+                    crec.property_count = props.count;
+                    checkpoints_.push_back(crec);
+                }
+
+                chunks_.push_back(rec);
+            }
+
+            // Lay out the sections after the header, each 4-byte aligned.
+            size_t offset = sizeof hdr;
+            const size_t counts[section_count] = {
+                strings_.size(),
+                string_data_.size(),
+                actors_.size(),
+                chunks_.size(),
+                checkpoints_.size(),
+                properties_.size(),
+                lists_.size(),
+                values_.size(),
+                blobs_.size()
+            };
+
+            for (int i = 0; i < section_count; ++i) {
+                offset = (offset + 3) & ~size_t(3);
+                hdr.sections[i].offset = static_cast<uint32_t>(offset);
+                hdr.sections[i].count = static_cast<uint32_t>(counts[i]);
+                offset += counts[i] * record_sizes[i];
+            }
+
+            if (offset > UINT32_MAX) {
+                throw error::general_exception("save too large for a snapshot");
+            }
+            hdr.file_length = static_cast<uint32_t>(offset);
+
+            buffer<unsigned char> b;
+            b.buf = std::make_unique<unsigned char[]>(offset);
+            b.length = offset;
+            memset(b.buf.get(), 0, offset);
+
+            unsigned char *base = b.buf.get();
+            store_record(base, hdr);
+            memcpy(base, magic, sizeof magic);
+            store_section(base + hdr.sections[strings].offset, strings_);
+            store_section(base + hdr.sections[string_data].offset, string_data_);
+            store_section(base + hdr.sections[actors].offset, actors_);
+            store_section(base + hdr.sections[chunks].offset, chunks_);
+            store_section(base + hdr.sections[checkpoints].offset, checkpoints_);
+            store_section(base + hdr.sections[properties].offset, properties_);
+            store_section(base + hdr.sections[lists].offset, lists_);
+            store_section(base + hdr.sections[values].offset, values_);
+            store_section(base + hdr.sections[blobs].offset, blobs_);
+            return b;
+        }
+
+    private:
+        uint32_t intern(const std::string& str)
+        {
+            auto it = string_ids_.find(str);
+            if (it != string_ids_.end()) {
+                return it->second;
+            }
+
+            uint32_t id = static_cast<uint32_t>(strings_.size());
+            strings_.push_back({ static_cast<uint32_t>(string_data_.size()), static_cast<uint32_t>(str.size()) });
+            string_data_.insert(string_data_.end(), str.begin(), str.end());
+            string_ids_.emplace(str, id);
+            return id;
+        }
+
+        int32_t add_blob(const unsigned char *data, int32_t length)
+        {
+            int32_t offset = static_cast<int32_t>(blobs_.size());
+            if (length > 0) {
+                blobs_.insert(blobs_.end(), data, data + length);
+            }
+            return offset;
+        }
+
+        // Write a property list as a contiguous range of records. Children
+        // of the properties in the list follow the range.
+        list_record write_list(const property_list& list)
+        {
+            list_record range{ static_cast<uint32_t>(properties_.size()), static_cast<uint32_t>(list.size()) };
+            properties_.resize(properties_.size() + list.size());
+            for (size_t i = 0; i < list.size(); ++i) {
+                property_record rec = make_record(*list[i]);
+                properties_[range.first + i] = rec;
+            }
+            return range;
+        }
+
+        property_record make_record(const property& prop)
+        {
+            property_record rec;
+            memset(&rec, 0, sizeof rec);
+            rec.kind = static_cast<uint32_t>(prop.kind);
+            rec.name = intern(prop.name);
+
+            switch (prop.kind)
+            {
+            case property::kind_t::int_property:
+                rec.a = static_cast<const int_property&>(prop).value;
+                break;
+            case property::kind_t::float_property:
+                memcpy(&rec.a, &static_cast<const float_property&>(prop).value, sizeof(float));
+                break;
+            case property::kind_t::bool_property:
+                rec.a = static_cast<const bool_property&>(prop).value;
+                break;
+            case property::kind_t::string_property:
+            {
+                const xcom_string& str = static_cast<const string_property&>(prop).str;
+                rec.a = intern(str.str);
+                rec.b = str.is_wide;
+                break;
+            }
+            case property::kind_t::name_property:
+            {
+                const name_property& name = static_cast<const name_property&>(prop);
+                rec.a = intern(name.str);
+                rec.b = name.number;
+                break;
+            }
+            case property::kind_t::object_property:
+                rec.a = static_cast<const object_property&>(prop).actor;
+                rec.b = (prop.size() == 4) ? 1 : 0;
+                break;
+            case property::kind_t::enum_property:
+            {
+                const enum_property& e = static_cast<const enum_property&>(prop);
+                rec.a = intern(e.type);
+                rec.b = intern(e.value.name);
+                rec.c = e.value.number;
+                break;
+            }
+            case property::kind_t::struct_property:
+            {
+                const struct_property& s = static_cast<const struct_property&>(prop);
+                rec.a = intern(s.struct_name);
+                if (s.native_data_length > 0) {
+                    rec.b = add_blob(s.native_data.get(), s.native_data_length);
+                    rec.c = s.native_data_length;
+                }
+                else {
+                    list_record members = write_list(s.properties);
+                    rec.first = members.first;
+                    rec.count = members.count;
+                }
+                break;
+            }
+            case property::kind_t::array_property:
+            {
+                const array_property& a = static_cast<const array_property&>(prop);
+                rec.a = add_blob(a.data.get(), a.data ? a.data_length : 0);
+                rec.b = a.data ? a.data_length : 0;
+                rec.c = a.array_bound;
+                break;
+            }
+            case property::kind_t::object_array_property:
+            {
+                const array_elements& elements = static_cast<const object_array_property&>(prop).elements;
+                rec.first = static_cast<uint32_t>(values_.size());
+                rec.count = static_cast<uint32_t>(elements.size());
+                values_.insert(values_.end(), elements.begin(), elements.end());
+                break;
+            }
+            case property::kind_t::number_array_property:
+            {
+                const array_elements& elements = static_cast<const number_array_property&>(prop).elements;
+                rec.first = static_cast<uint32_t>(values_.size());
+                rec.count = static_cast<uint32_t>(elements.size());
+                values_.insert(values_.end(), elements.begin(), elements.end());
+                break;
+            }
+            case property::kind_t::string_array_property:
+            {
+                const std::vector<xcom_string>& elements = static_cast<const string_array_property&>(prop).elements;
+                rec.first = static_cast<uint32_t>(values_.size());
+                rec.count = static_cast<uint32_t>(elements.size());
+                for (const xcom_string& str : elements) {
+                    values_.push_back(intern(str.str));
+                    values_.push_back(str.is_wide);
+                }
+                break;
+            }
+            case property::kind_t::enum_array_property:
+            {
+                const std::vector<enum_value>& elements = static_cast<const enum_array_property&>(prop).elements;
+                rec.first = static_cast<uint32_t>(values_.size());
+                rec.count = static_cast<uint32_t>(elements.size());
+                for (const enum_value& v : elements) {
+                    values_.push_back(intern(v.name));
+                    values_.push_back(v.number);
+                }
+                break;
+            }
+            case property::kind_t::struct_array_property:
+            {
+                // Reserve the list records first so the elements are contiguous.
+                const std::vector<property_list>& elements = static_cast<const struct_array_property&>(prop).elements;
+                rec.first = static_cast<uint32_t>(lists_.size());
+                rec.count = static_cast<uint32_t>(elements.size());
+                lists_.resize(lists_.size() + elements.size());
+                for (size_t i = 0; i < elements.size(); ++i) {
+                    list_record element = write_list(elements[i]);
+                    lists_[rec.first + i] = element;
+                }
+                break;
+            }
+            case property::kind_t::static_array_property:
+            {
+                list_record items = write_list(static_cast<const static_array_property&>(prop).properties);
+                rec.first = items.first;
+                rec.count = items.count;
+                break;
+            }
+            default:
+                throw error::general_exception("can't snapshot property " + prop.name);
+            }
+
+            return rec;
+        }
+
+        std::unordered_map<std::string, uint32_t> string_ids_;
+        std::vector<string_entry> strings_;
+        std::vector<char> string_data_;
+        std::vector<uint32_t> actors_;
+        std::vector<chunk_record> chunks_;
+        std::vector<checkpoint_record> checkpoints_;
+        std::vector<property_record> properties_;
+        std::vector<list_record> lists_;
+        std::vector<int32_t> values_;
+        std::vector<unsigned char> blobs_;
+    };
+
+    bool is_snapshot(const std::string& infile)
+    {
+        FILE *fp = fopen(infile.c_str(), "rb");
+        if (fp == nullptr) {
+            return false;
+        }
+        char start[sizeof magic];
+        bool match = fread(start, 1, sizeof start, fp) == sizeof start && memcmp(start, magic, sizeof magic) == 0;
+        fclose(fp);
+        return match;
+    }
+
+    buffer<unsigned char> write_snapshot(saved_game& save)
+    {
+        snapshot_writer w;
+        return w.write(save);
+    }
+
+    void write_snapshot(saved_game& save, const std::string& outfile)
+    {
+        buffer<unsigned char> b = write_snapshot(save);
+        FILE *fp = fopen(outfile.c_str(), "wb");
+        if (fp == nullptr) {
+            throw error::general_exception("error opening output file " + outfile);
+        }
+        fwrite(b.buf.get(), 1, b.length, fp);
+        fclose(fp);
+    }
+
+    snapshot::snapshot(const std::string& infile)
+    {
+#ifndef _WIN32
+        int fd = open(infile.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw error::general_exception("error opening file");
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            throw invalid_snapshot("empty file");
+        }
+
+        void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            throw error::general_exception("error mapping file");
+        }
+
+        mapping_ = mapping;
+        data_ = static_cast<const unsigned char*>(mapping);
+        length_ = st.st_size;
+#else
+        owned_ = read_file(infile);
+        data_ = owned_.buf.get();
+        length_ = owned_.length;
+#endif
+        try {
+            validate();
+        }
+        catch (...) {
+#ifndef _WIN32
+            munmap(mapping_, length_);
+#endif
+            throw;
+        }
+    }
+
+    snapshot::snapshot(buffer<unsigned char>&& data) :
+        owned_(std::move(data))
+    {
+        data_ = owned_.buf.get();
+        length_ = owned_.length;
+        validate();
+    }
+
+    snapshot::~snapshot()
+    {
+#ifndef _WIN32
+        if (mapping_ != nullptr) {
+            munmap(mapping_, length_);
+        }
+#endif
+    }
+
+    void snapshot::validate()
+    {
+        if (length_ < sizeof header_) {
+            throw invalid_snapshot("file too short");
+        }
+        header_ = load_record<file_header>(data_);
+        memcpy(header_.magic, data_, sizeof header_.magic);
+
+        if (memcmp(header_.magic, magic, sizeof magic) != 0) {
+            throw invalid_snapshot("not a snapshot");
+        }
+        if (header_.format_version != current_version) {
+            throw invalid_snapshot("unsupported snapshot version " + std::to_string(header_.format_version));
+        }
+        if (header_.file_length != length_) {
+            throw invalid_snapshot("file length mismatch");
+        }
+        if (!supported_version(version())) {
+            throw error::unsupported_version(version());
+        }
+
+        for (int i = 0; i < section_count; ++i) {
+            uint64_t end = uint64_t(header_.sections[i].offset) + uint64_t(header_.sections[i].count) * record_sizes[i];
+            if (header_.sections[i].offset < sizeof header_ || end > length_) {
+                throw invalid_snapshot("section out of bounds");
+            }
+        }
+        if (header_.global_actor_count > header_.sections[actors].count) {
+            throw invalid_snapshot("actor count out of bounds");
+        }
+
+        // Check every string is within the string data, so string() can
+        // trust the table.
+        for (uint32_t i = 0; i < header_.sections[strings].count; ++i) {
+            string_entry entry = record<string_entry>(strings, i);
+            if (uint64_t(entry.offset) + entry.length > header_.sections[string_data].count) {
+                throw invalid_snapshot("string out of bounds");
+            }
+        }
+    }
+
+    template <typename T>
+    T snapshot::record(section_id id, size_t index) const
+    {
+        return load_record<T>(data_ + header_.sections[id].offset + index * sizeof(T));
+    }
+
+    void snapshot::check_range(section_id id, uint32_t first, uint32_t count) const
+    {
+        if (uint64_t(first) + count > header_.sections[id].count) {
+            throw invalid_snapshot("record index out of bounds");
+        }
+    }
+
+    xcom_version snapshot::version() const
+    {
+        return static_cast<xcom_version>(header_.version);
+    }
+
+    size_t snapshot::chunk_count() const
+    {
+        return header_.sections[chunks].count;
+    }
+
+    size_t snapshot::checkpoint_count() const
+    {
+        return header_.sections[checkpoints].count;
+    }
+
+    size_t snapshot::property_count() const
+    {
+        return header_.sections[properties].count;
+    }
+
+    std::string_view snapshot::string(uint32_t id) const
+    {
+        check_range(strings, id, 1);
+        string_entry entry = record<string_entry>(strings, id);
+        const char *base = reinterpret_cast<const char*>(data_ + header_.sections[string_data].offset);
+        return std::string_view{ base + entry.offset, entry.length };
+    }
+
+    chunk_record snapshot::chunk_at(size_t index) const
+    {
+        check_range(chunks, static_cast<uint32_t>(index), 1);
+        return record<chunk_record>(chunks, index);
+    }
+
+    checkpoint_record snapshot::checkpoint_at(size_t index) const
+    {
+        check_range(checkpoints, static_cast<uint32_t>(index), 1);
+        return record<checkpoint_record>(checkpoints, index);
+    }
+
+    property_record snapshot::property_at(size_t index) const
+    {
+        check_range(properties, static_cast<uint32_t>(index), 1);
+        return record<property_record>(properties, index);
+    }
+
+    std::unique_ptr<unsigned char[]> snapshot::load_blob(int32_t offset, int32_t length) const
+    {
+        if (offset < 0 || length < 0) {
+            throw invalid_snapshot("invalid blob");
+        }
+        check_range(blobs, offset, length);
+        std::unique_ptr<unsigned char[]> data = std::make_unique<unsigned char[]>(length);
+        memcpy(data.get(), data_ + header_.sections[blobs].offset + offset, length);
+        return data;
+    }
+
+    property_list snapshot::load_property_list(uint32_t first, uint32_t count, xcom_version version) const
+    {
+        check_range(properties, first, count);
+        property_list list;
+        list.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            list.push_back(load_property(first + i, version));
+        }
+        return list;
+    }
+
+    property_ptr snapshot::load_property(size_t index, xcom_version version) const
+    {
+        property_record rec = record<property_record>(properties, index);
+        std::string name{ string(rec.name) };
+
+        switch (static_cast<property::kind_t>(rec.kind))
+        {
+        case property::kind_t::int_property:
+            return std::make_unique<int_property>(name, rec.a);
+        case property::kind_t::float_property:
+        {
+            float value;
+            memcpy(&value, &rec.a, sizeof value);
+            return std::make_unique<float_property>(name, value);
+        }
+        case property::kind_t::bool_property:
+            return std::make_unique<bool_property>(name, rec.a != 0);
+        case property::kind_t::string_property:
+            return std::make_unique<string_property>(name, xcom_string{ std::string(string(rec.a)), rec.b != 0 });
+        case property::kind_t::name_property:
+            return std::make_unique<name_property>(name, std::string(string(rec.a)), rec.b);
+        case property::kind_t::object_property:
+            if (rec.b != 0) {
+                return std::make_unique<object_property_EU>(name, rec.a);
+            }
+            return std::make_unique<object_property>(name, rec.a);
+        case property::kind_t::enum_property:
+            return std::make_unique<enum_property>(name, std::string(string(rec.a)), std::string(string(rec.b)), rec.c);
+        case property::kind_t::struct_property:
+            if (rec.c > 0) {
+                return std::make_unique<struct_property>(name, std::string(string(rec.a)), load_blob(rec.b, rec.c), rec.c);
+            }
+            return std::make_unique<struct_property>(name, std::string(string(rec.a)),
+                load_property_list(rec.first, rec.count, version));
+        case property::kind_t::array_property:
+        {
+            std::unique_ptr<unsigned char[]> data = (rec.b > 0) ? load_blob(rec.a, rec.b) : nullptr;
+            return std::make_unique<array_property>(name, std::move(data), rec.b, rec.c);
+        }
+        case property::kind_t::object_array_property:
+        case property::kind_t::number_array_property:
+        {
+            check_range(values, rec.first, rec.count);
+            array_elements elements(rec.count);
+            le_load_array(elements.data(), data_ + header_.sections[values].offset + rec.first * sizeof(int32_t),
+                rec.count);
+            if (rec.kind == static_cast<uint32_t>(property::kind_t::object_array_property)) {
+                return std::make_unique<object_array_property>(name, std::move(elements));
+            }
+            return std::make_unique<number_array_property>(name, std::move(elements));
+        }
+        case property::kind_t::string_array_property:
+        {
+            check_range(values, rec.first, rec.count * 2);
+            std::vector<xcom_string> elements;
+            elements.reserve(rec.count);
+            for (uint32_t i = 0; i < rec.count; ++i) {
+                int32_t id = record<int32_t>(values, rec.first + 2 * i);
+                int32_t is_wide = record<int32_t>(values, rec.first + 2 * i + 1);
+                elements.push_back(xcom_string{ std::string(string(id)), is_wide != 0 });
+            }
+            return std::make_unique<string_array_property>(name, std::move(elements));
+        }
+        case property::kind_t::enum_array_property:
+        {
+            check_range(values, rec.first, rec.count * 2);
+            std::vector<enum_value> elements;
+            elements.reserve(rec.count);
+            for (uint32_t i = 0; i < rec.count; ++i) {
+                int32_t id = record<int32_t>(values, rec.first + 2 * i);
+                int32_t number = record<int32_t>(values, rec.first + 2 * i + 1);
+                elements.push_back(enum_value{ std::string(string(id)), number });
+            }
+            return std::make_unique<enum_array_property>(name, std::move(elements));
+        }
+        case property::kind_t::struct_array_property:
+        {
+            check_range(lists, rec.first, rec.count);
+            std::vector<property_list> elements;
+            elements.reserve(rec.count);
+            for (uint32_t i = 0; i < rec.count; ++i) {
+                list_record element = record<list_record>(lists, rec.first + i);
+                elements.push_back(load_property_list(element.first, element.count, version));
+            }
+            return std::make_unique<struct_array_property>(name, std::move(elements));
+        }
+        case property::kind_t::static_array_property:
+        {
+            std::unique_ptr<static_array_property> sa = std::make_unique<static_array_property>(name);
+            sa->properties = load_property_list(rec.first, rec.count, version);
+            return sa;
+        }
+        default:
+            throw invalid_snapshot("unknown property kind " + std::to_string(rec.kind));
+        }
+    }
+
+    saved_game snapshot::load() const
+    {
+        saved_game save;
+        xcom_version ver = version();
+
+        save.hdr.version = ver;
+        save.hdr.uncompressed_size = header_.uncompressed_size;
+        save.hdr.game_number = header_.game_number;
+        save.hdr.save_number = header_.save_number;
+        save.hdr.save_description = { std::string(string(header_.save_description)), header_.save_description_is_wide != 0 };
+        save.hdr.time = { std::string(string(header_.time)), header_.time_is_wide != 0 };
+        save.hdr.map_command = std::string(string(header_.map_command));
+        save.hdr.tactical_save = header_.tactical_save != 0;
+        save.hdr.ironman = header_.ironman != 0;
+        save.hdr.autosave = header_.autosave != 0;
+        save.hdr.dlc = std::string(string(header_.dlc));
+        save.hdr.language = std::string(string(header_.language));
+        save.hdr.profile_number = header_.profile_number;
+        save.hdr.profile_date = { std::string(string(header_.profile_date)), header_.profile_date_is_wide != 0 };
+
+        save.actors.reserve(header_.global_actor_count);
+        for (uint32_t i = 0; i < header_.global_actor_count; ++i) {
+            save.actors.push_back(std::string(string(record<uint32_t>(actors, i))));
+        }
+
+        save.checkpoints.resize(chunk_count());
+        for (size_t c = 0; c < chunk_count(); ++c) {
+            chunk_record rec = record<chunk_record>(chunks, c);
+            checkpoint_chunk& chunk = save.checkpoints[c];
+            chunk.unknown_int1 = rec.unknown_int1;
+            chunk.game_type = std::string(string(rec.game_type));
+            chunk.unknown_int2 = rec.unknown_int2;
+            chunk.class_name = std::string(string(rec.class_name));
+            chunk.unknown_int3 = rec.unknown_int3;
+            chunk.display_name = std::string(string(rec.display_name));
+            chunk.map_name = std::string(string(rec.map_name));
+            chunk.unknown_int4 = rec.unknown_int4;
+
+            check_range(actors, rec.first_actor, rec.actor_count);
+            chunk.actors.reserve(rec.actor_count);
+            for (uint32_t i = 0; i < rec.actor_count; ++i) {
+                chunk.actors.push_back(std::string(string(record<uint32_t>(actors, rec.first_actor + i))));
+            }
+
+            check_range(checkpoints, rec.first_checkpoint, rec.checkpoint_count);
+            chunk.checkpoints.resize(rec.checkpoint_count);
+            for (uint32_t i = 0; i < rec.checkpoint_count; ++i) {
+                checkpoint_record crec = record<checkpoint_record>(checkpoints, rec.first_checkpoint + i);
+                checkpoint& chk = chunk.checkpoints[i];
+                chk.name = std::string(string(crec.name));
+                chk.instance_name = std::string(string(crec.instance_name));
+                chk.class_name = std::string(string(crec.class_name));
+                std::copy(crec.vector, crec.vector + 3, chk.vector.begin());
+                std::copy(crec.rotator, crec.rotator + 3, chk.rotator.begin());
+                chk.properties = load_property_list(crec.first_property, crec.property_count, ver);
+                chk.template_index = crec.template_index;
+                chk.pad_size = crec.pad_size;
+            }
+        }
+
+        return save;
+    }
+}
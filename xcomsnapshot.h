@@ -0,0 +1,226 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMSNAPSHOT_H
+#define XCOMSNAPSHOT_H
+
+#include "xcom.h"
+
+#include <string_view>
+
+namespace xcom
+{
+    // A snapshot is a parsed save stored in a compact binary form that can be
+    // reloaded without decompressing or parsing the original save. The file
+    // is a header followed by sections of fixed-size records. Records refer
+    // to each other by index and to strings by an id in an interned string
+    // table, so the file can be used directly from a memory mapping.
+    //
+    // All values are little-endian 32-bit integers or floats, on any host.
+    // Records are not necessarily aligned and are decoded as they're read.
+    namespace snapshot_format
+    {
+        static const char magic[4] = { 'X', 'C', 'S', 'S' };
+
+        // Bump when the layout changes. Snapshots of other versions are
+        // rejected rather than converted: they are a cache, not an archive.
+        static const uint32_t current_version = 1;
+
+        enum section_id
+        {
+            strings,        // string_entry
+            string_data,    // bytes
+            actors,         // uint32_t string ids: global actors then chunk actors
+            chunks,         // chunk_record
+            checkpoints,    // checkpoint_record
+            properties,     // property_record
+            lists,          // list_record, for struct array elements
+            values,         // int32_t, for number, object, string and enum arrays
+            blobs,          // bytes, for native struct data and raw arrays
+            section_count
+        };
+
+        // The location of a section: an offset from the start of the file
+        // and a count of records (or bytes for byte sections).
+        struct section
+        {
+            uint32_t offset;
+            uint32_t count;
+        };
+
+        struct file_header
+        {
+            char magic[4];
+            uint32_t format_version;
+            uint32_t file_length;
+            uint32_t global_actor_count;
+            section sections[section_count];
+
+            // The save header
+            uint32_t version;
+            int32_t uncompressed_size;
+            int32_t game_number;
+            int32_t save_number;
+            uint32_t save_description;
+            uint32_t save_description_is_wide;
+            uint32_t time;
+            uint32_t time_is_wide;
+            uint32_t map_command;
+            uint32_t tactical_save;
+            uint32_t ironman;
+            uint32_t autosave;
+            uint32_t dlc;
+            uint32_t language;
+            int32_t profile_number;
+            uint32_t profile_date;
+            uint32_t profile_date_is_wide;
+        };
+
+        struct string_entry
+        {
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        struct chunk_record
+        {
+            int32_t unknown_int1;
+            uint32_t game_type;
+            int32_t unknown_int2;
+            uint32_t class_name;
+            int32_t unknown_int3;
+            uint32_t display_name;
+            uint32_t map_name;
+            int32_t unknown_int4;
+            uint32_t first_checkpoint;
+            uint32_t checkpoint_count;
+            uint32_t first_actor;
+            uint32_t actor_count;
+        };
+
+        struct checkpoint_record
+        {
+            uint32_t name;
+            uint32_t instance_name;
+            uint32_t class_name;
+            float vector[3];
+            int32_t rotator[3];
+            int32_t template_index;
+            uint32_t pad_size;
+            uint32_t first_property;
+            uint32_t property_count;
+        };
+
+        // A property. The meaning of a, b and c depends on the kind:
+        //
+        //   int, bool:     a = value
+        //   float:         a = value bits
+        //   string:        a = string, b = is_wide
+        //   name:          a = string, b = number
+        //   object:        a = actor, b = 1 for the 4 byte EU form
+        //   enum:          a = type, b = value name, c = number
+        //   struct:        a = struct name, b = blob offset, c = native data
+        //                  length; if c is 0 the members are properties
+        //                  [first, first + count)
+        //   array:         a = blob offset, b = data length, c = array bound
+        //   object/number
+        //   arrays:        values [first, first + count)
+        //   string/enum
+        //   arrays:        value pairs (string, is_wide) or (name, number)
+        //                  starting at first, count pairs
+        //   struct array:  lists [first, first + count)
+        //   static array:  properties [first, first + count)
+        struct property_record
+        {
+            uint32_t kind;
+            uint32_t name;
+            int32_t a;
+            int32_t b;
+            int32_t c;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        // A range of properties: one element of a struct array.
+        struct list_record
+        {
+            uint32_t first;
+            uint32_t count;
+        };
+    }
+
+    // Does the file start like a snapshot? Lets tools that take saves accept
+    // snapshots too.
+    bool is_snapshot(const std::string& infile);
+
+    // Write a snapshot of a save. Checkpoints read with lazy_properties are
+    // parsed first.
+    buffer<unsigned char> write_snapshot(saved_game& save);
+    void write_snapshot(saved_game& save, const std::string& outfile);
+
+    // A snapshot loaded into memory, mapped from a file where possible.
+    class snapshot
+    {
+    public:
+        explicit snapshot(const std::string& infile);
+        explicit snapshot(buffer<unsigned char>&& data);
+        ~snapshot();
+
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+
+        xcom_version version() const;
+
+        size_t chunk_count() const;
+        size_t checkpoint_count() const;
+        size_t property_count() const;
+
+        // An interned string. The view points into the snapshot.
+        std::string_view string(uint32_t id) const;
+
+        // Read one record of a section.
+        snapshot_format::chunk_record chunk_at(size_t index) const;
+        snapshot_format::checkpoint_record checkpoint_at(size_t index) const;
+        snapshot_format::property_record property_at(size_t index) const;
+
+        // Rebuild the save the snapshot was taken of.
+        saved_game load() const;
+
+    private:
+        void validate();
+
+        template <typename T>
+        T record(snapshot_format::section_id id, size_t index) const;
+
+        property_ptr load_property(size_t index, xcom_version version) const;
+        property_list load_property_list(uint32_t first, uint32_t count, xcom_version version) const;
+        std::unique_ptr<unsigned char[]> load_blob(int32_t offset, int32_t length) const;
+        void check_range(snapshot_format::section_id id, uint32_t first, uint32_t count) const;
+
+        const unsigned char *data_ = nullptr;
+        size_t length_ = 0;
+        snapshot_format::file_header header_;
+
+        // Either the mapping of the file or an owned copy of its data.
+        void *mapping_ = nullptr;
+        buffer<unsigned char> owned_;
+    };
+}
+
+#endif // XCOMSNAPSHOT_H
@@ -0,0 +1,169 @@
+/*
+XCom EW Saved Game Reader
+Copyright(C) 2015
+
+This program is free software; you can redistribute it and / or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110 - 1301 USA.
+*/
+
+#ifndef XCOMSTRUCTS_H
+#define XCOMSTRUCTS_H
+
+#include "xcom.h"
+
+#include <string_view>
+
+namespace xcom
+{
+    // Structs the engine serializes natively: as their raw field values
+    // rather than as a list of tagged properties. A struct_property of one of
+    // these types holds its value in native_data; this table gives the size
+    // of that data and where each field is in it.
+
+    // A field of a native struct. A number is an int or float of 'size'
+    // bytes (single bytes are unsigned); a nested native struct has its name
+    // in struct_name.
+    struct native_field
+    {
+        std::string_view name;
+        int32_t offset;
+        int32_t size;
+        std::string_view struct_name;
+        bool is_float;
+    };
+
+    struct native_struct_layout
+    {
+        std::string_view name;
+        int32_t size;
+        const native_field *fields;
+        size_t field_count;
+    };
+
+    namespace detail
+    {
+        inline constexpr native_field vector2d_fields[] = {
+            { "X", 0, 4, {}, true },
+            { "Y", 4, 4, {}, true },
+        };
+
+        inline constexpr native_field vector_fields[] = {
+            { "X", 0, 4, {}, true },
+            { "Y", 4, 4, {}, true },
+            { "Z", 8, 4, {}, true },
+        };
+
+        inline constexpr native_field rotator_fields[] = {
+            { "Pitch", 0, 4, {}, false },
+            { "Yaw", 4, 4, {}, false },
+            { "Roll", 8, 4, {}, false },
+        };
+
+        inline constexpr native_field box_fields[] = {
+            { "Min", 0, 12, "Vector", false },
+            { "Max", 12, 12, "Vector", false },
+            { "IsValid", 24, 1, {}, false },
+        };
+
+        inline constexpr native_field color_fields[] = {
+            { "B", 0, 1, {}, false },
+            { "G", 1, 1, {}, false },
+            { "R", 2, 1, {}, false },
+            { "A", 3, 1, {}, false },
+        };
+
+        template <size_t N>
+        constexpr native_struct_layout layout(std::string_view name, int32_t size, const native_field (&fields)[N])
+        {
+            return { name, size, fields, N };
+        }
+    }
+
+    // Every native struct. make_struct_property reads structs with these
+    // names as raw data, so only add structs the game stores natively.
+    inline constexpr native_struct_layout native_structs[] = {
+        detail::layout("Vector2D", 8, detail::vector2d_fields),
+        detail::layout("Vector", 12, detail::vector_fields),
+        detail::layout("Rotator", 12, detail::rotator_fields),
+        detail::layout("Box", 25, detail::box_fields),
+        detail::layout("Color", 4, detail::color_fields),
+    };
+
+    namespace detail
+    {
+        // Fields must be packed in order with no padding and fill the struct.
+        constexpr bool is_packed(const native_struct_layout& layout)
+        {
+            int32_t offset = 0;
+            for (size_t i = 0; i < layout.field_count; ++i) {
+                if (layout.fields[i].offset != offset) {
+                    return false;
+                }
+                offset += layout.fields[i].size;
+            }
+            return offset == layout.size;
+        }
+
+        constexpr bool all_packed()
+        {
+            for (const native_struct_layout& layout : native_structs) {
+                if (!is_packed(layout)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+
+    static_assert(detail::all_packed(), "native struct fields must be packed and add up to the struct size");
+
+    // The layout of the native struct with this name, or null if structs of
+    // this name are stored as a property list.
+    inline const native_struct_layout* find_native_struct(std::string_view struct_name)
+    {
+        for (const native_struct_layout& layout : native_structs) {
+            if (layout.name == struct_name) {
+                return &layout;
+            }
+        }
+        return nullptr;
+    }
+
+    // The size of the native struct with this name, or 0 if structs of this
+    // name are stored as a property list.
+    inline int32_t native_struct_size(std::string_view struct_name)
+    {
+        const native_struct_layout *layout = find_native_struct(struct_name);
+        return layout != nullptr ? layout->size : 0;
+    }
+
+    // Find a field of a native struct by name, e.g. the "Yaw" of a
+    // "Rotator". Returns false if there's no such struct or field.
+    inline bool find_native_field(std::string_view struct_name, std::string_view field_name, native_field& field)
+    {
+        const native_struct_layout *layout = find_native_struct(struct_name);
+        if (layout == nullptr) {
+            return false;
+        }
+        for (size_t i = 0; i < layout->field_count; ++i) {
+            if (layout->fields[i].name == field_name) {
+                field = layout->fields[i];
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+#endif // XCOMSTRUCTS_H
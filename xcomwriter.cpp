@@ -20,9 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "xcomio.h"
 #include "minilzo.h"
 #include "zlib.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
-#include <tuple>
 
 namespace xcom
 {
@@ -77,31 +77,41 @@ namespace xcom
     {
         // Each actorTable entry has 2 entries in the save table; names are split.
         w.write_int(static_cast<int32_t>(actors.size() * 2));
-        for (const std::string& actor : actors) {
-            std::tuple<std::string, std::string, int> tup = decompose_actor_name(actor);
-            w.write_string(std::get<1>(tup));
-            w.write_int(std::get<2>(tup));
-            w.write_string(std::get<0>(tup));
+        for (size_t i = 0; i < actors.size(); ++i) {
+            w.write_string(actors.class_name(i));
+            w.write_int(actors.instance(i));
+            w.write_string(actors.package(i));
             w.write_int(0);
         }
     }
 
     static void write_actor_table_EU(xcom_io& w, const actor_table& actors)
     {
-        // Each actorTable entry has 2 entries in the save table; names are split.
         w.write_int(static_cast<int32_t>(actors.size() ) );
-        for (const std::string& actor : actors) {
-            std::tuple<std::string, int> tup = decompose_actor_name_EU(actor);
-            w.write_string(std::get<0>(tup));
-             w.write_int(std::get<1>(tup));
+        for (size_t i = 0; i < actors.size(); ++i) {
+            if (actors.has_package(i)) {
+                // Not an EU name: keep the whole prefix as the class.
+                w.write_string(actors.package(i) + "." + actors.class_name(i));
+            }
+            else {
+                w.write_string(actors.class_name(i));
+            }
+            w.write_int(actors.instance(i));
         }
     }
     
     
-    struct property_writer_visitor : public property_visitor
+    struct property_writer_visitor final : public property_visitor
     {
         property_writer_visitor(xcom_io& w) : io_(w) {}
 
+        // Write a property's value, dispatching on its kind with no virtual
+        // calls.
+        void dispatch(property& prop)
+        {
+            visit_property(prop, [this](auto& p) { visit(&p); });
+        }
+
         virtual void visit(int_property* prop) override
         {
             io_.write_int(prop->value);
@@ -203,9 +213,7 @@ namespace xcom
         virtual void visit(number_array_property *prop) override
         {
             io_.write_int(static_cast<int32_t>(prop->elements.size()));
-            for (size_t i = 0; i < prop->elements.size(); ++i) {
-                io_.write_int(prop->elements[i]);
-            }
+            io_.write_array(prop->elements.data(), prop->elements.size());
         }
 
         virtual void visit(string_array_property *prop) override
@@ -259,10 +267,9 @@ namespace xcom
         // contained properties, not the fake static array property created to
         // contain it.
         if (prop->kind == property::kind_t::static_array_property) {
-            static_array_property* static_array =
-                dynamic_cast<static_array_property*>(prop.get());
-            for (unsigned int idx = 0; idx < static_array->properties.size(); ++idx) {
-                write_property(w, static_array->properties[idx], idx);
+            const static_array_property& static_array = property_cast<static_array_property>(*prop);
+            for (unsigned int idx = 0; idx < static_array.properties.size(); ++idx) {
+                write_property(w, static_array.properties[idx], idx);
             }
         }
         else {
@@ -276,11 +283,56 @@ namespace xcom
 
             // Write the specific part
             property_writer_visitor v{ w };
-            prop->accept(&v);
+            v.dispatch(*prop);
         }
     }
 
-    static void write_checkpoint(xcom_io& w, const checkpoint& chk)
+    // Can this checkpoint's properties be written by copying the bytes they
+    // were read from? True if they were never parsed, or haven't been
+    // modified since.
+    static bool can_copy_properties(const checkpoint& chk, xcom_version version)
+    {
+        if (chk.property_data.empty() || chk.property_data.source->version != version) {
+            return false;
+        }
+        return !chk.dirty || !chk.properties_loaded;
+    }
+
+    // The size of a checkpoint's properties as written by write_checkpoint()
+    // when they can't be copied.
+    static int32_t total_property_size(const checkpoint& chk)
+    {
+        int32_t total_property_size = 0;
+        std::for_each(chk.properties.begin(), chk.properties.end(),
+            [&total_property_size](const property_ptr& prop) {
+                total_property_size += prop->full_size();
+            });
+        // length of trailing "None" to terminate the list + the unknown int.
+        total_property_size += 9 + 4;
+        total_property_size += chk.pad_size;
+        return total_property_size;
+    }
+
+    // The size of a narrow string as written by xcom_io::write_string().
+    static size_t string_size(const std::string& str)
+    {
+        return str.empty() ? 4 : util::utf8_to_iso8859_1(str).length() + 5;
+    }
+
+    // The exact number of bytes write_checkpoint() writes for a checkpoint.
+    static size_t checkpoint_size(const checkpoint& chk, xcom_version version)
+    {
+        // Names, then the vector and rotator.
+        size_t size = string_size(chk.name) + string_size(chk.instance_name) + 24 + string_size(chk.class_name);
+        // The property length, the properties and the template index.
+        size += 4;
+        size += can_copy_properties(chk, version) ? chk.property_data.length : total_property_size(chk);
+        size += 4;
+        return size;
+    }
+
+    // The checkpoint fields ahead of its property length.
+    static void write_checkpoint_header(xcom_io& w, const checkpoint& chk)
     {
         w.write_string(chk.name);
         w.write_string(chk.instance_name);
@@ -291,15 +343,22 @@ namespace xcom
         w.write_int(chk.rotator[1]);
         w.write_int(chk.rotator[2]);
         w.write_string(chk.class_name);
-        int32_t total_property_size = 0;
-        std::for_each(chk.properties.begin(), chk.properties.end(),
-            [&total_property_size](const property_ptr& prop) {
-                total_property_size += prop->full_size();
-            });
-        // length of trailing "None" to terminate the list + the unknown int.
-        total_property_size += 9 + 4;
-        total_property_size += chk.pad_size;
-        w.write_int(total_property_size);
+    }
+
+    static void write_checkpoint(xcom_io& w, const checkpoint& chk, xcom_version version)
+    {
+        write_checkpoint_header(w, chk);
+
+        if (can_copy_properties(chk, version)) {
+            // Unchanged since it was read: copy the original property bytes
+            // (including padding) straight through.
+            w.write_int(static_cast<int32_t>(chk.property_data.length));
+            w.write_raw(chk.property_data.data(), static_cast<int32_t>(chk.property_data.length));
+            w.write_int(chk.template_index);
+            return;
+        }
+
+        w.write_int(total_property_size(chk));
         for (unsigned int i = 0; i < chk.properties.size(); ++i) {
             write_property(w, chk.properties[i], 0);
         }
@@ -312,21 +371,61 @@ namespace xcom
         w.write_int(chk.template_index);
     }
 
-    static void write_checkpoint_table(xcom_io &w, const checkpoint_table& table)
+    // A checkpoint that has space reserved for it in the output but is yet to
+    // be written there. See write_checkpoints_parallel().
+    struct checkpoint_slot
+    {
+        const checkpoint *chk;
+        size_t size;
+        std::ptrdiff_t offset;
+    };
+
+    // The checkpoints to write in parallel, in the order they appear in the
+    // save, and the next one to reserve space for.
+    struct checkpoint_layout
+    {
+        std::vector<checkpoint_slot> slots;
+        size_t next = 0;
+    };
+
+    static void write_checkpoint_table(xcom_io &w, const checkpoint_table& table, xcom_version version,
+        checkpoint_layout *layout)
     {
         w.write_int(static_cast<int32_t>(table.size()));
-        for (const checkpoint& chk : table) {
-            write_checkpoint(w, chk);
+        if (layout == nullptr) {
+            for (const checkpoint& chk : table) {
+                write_checkpoint(w, chk, version);
+            }
+            return;
+        }
+
+        // Reserve space for the checkpoints and leave them to be written
+        // later. Their offsets are the running total of the sizes before them.
+        size_t table_size = 0;
+        for (size_t i = 0; i < table.size(); ++i) {
+            table_size += layout->slots[layout->next + i].size;
+        }
+        w.ensure(table_size);
+        for (size_t i = 0; i < table.size(); ++i) {
+            checkpoint_slot &slot = layout->slots[layout->next++];
+            assert(slot.chk == &table[i]);
+            slot.offset = w.offset();
+            w.seek(xcom_io::seek_kind::current, slot.size);
         }
     }
 
-    static void write_checkpoint_chunk(xcom_io & w, const checkpoint_chunk& chunk, xcom_version version)
+    // The chunk fields ahead of its checkpoint table.
+    static void write_chunk_prefix(xcom_io& w, const checkpoint_chunk& chunk)
     {
         w.write_int(chunk.unknown_int1);
         w.write_string(chunk.game_type);
         w.write_string("None");
         w.write_int(chunk.unknown_int2);
-        write_checkpoint_table(w, chunk.checkpoints);
+    }
+
+    // The chunk fields following its checkpoint table.
+    static void write_chunk_suffix(xcom_io& w, const checkpoint_chunk& chunk, xcom_version version)
+    {
         w.write_int(0); // name table length
         w.write_string(chunk.class_name);
         if(xcom_version::enemy_unknown != version)
@@ -344,14 +443,142 @@ namespace xcom
         w.write_int(chunk.unknown_int4);
     }
 
+    // Are the bytes written to scratch the same as those at pos in the
+    // original data? If so, advance pos past them. Either way, rewind
+    // scratch for the next comparison.
+    static bool matches_original(xcom_io& scratch, const unsigned char *original, size_t length, size_t& pos)
+    {
+        size_t count = static_cast<size_t>(scratch.offset());
+        scratch.seek(xcom_io::seek_kind::start, 0);
+        if (count > length - pos || memcmp(original + pos, scratch.pointer(), count) != 0) {
+            return false;
+        }
+        pos += count;
+        return true;
+    }
+
+    // Would writing the chunk field by field give the bytes it was read
+    // from, apart from its checkpoints' properties? The chunk's fields, its
+    // actor table and checkpoint list, and each checkpoint's names,
+    // position and class are public members that callers may change
+    // without setting 'dirty', so they're checked against the original.
+    static bool chunk_matches_original(const checkpoint_chunk& chunk, xcom_version version)
+    {
+        const unsigned char *original = chunk.data.data();
+        size_t length = chunk.data.length;
+        size_t pos = 0;
+        xcom_io scratch;
+
+        write_chunk_prefix(scratch, chunk);
+        scratch.write_int(static_cast<int32_t>(chunk.checkpoints.size()));
+        if (!matches_original(scratch, original, length, pos)) {
+            return false;
+        }
+
+        for (const checkpoint& chk : chunk.checkpoints) {
+            // The properties must be the ones that followed this header
+            // when it was read, not those of a checkpoint from elsewhere.
+            write_checkpoint_header(scratch, chk);
+            scratch.write_int(static_cast<int32_t>(chk.property_data.length));
+            if (!matches_original(scratch, original, length, pos) ||
+                    chk.property_data.source != chunk.data.source ||
+                    chk.property_data.offset != chunk.data.offset + pos ||
+                    chk.property_data.length > length - pos) {
+                return false;
+            }
+            pos += chk.property_data.length;
+
+            scratch.write_int(chk.template_index);
+            if (!matches_original(scratch, original, length, pos)) {
+                return false;
+            }
+        }
+
+        write_chunk_suffix(scratch, chunk, version);
+        return matches_original(scratch, original, length, pos) && pos == length;
+    }
+
+    // Can this chunk be written by copying the bytes it was read from? Only
+    // if neither it nor any of its checkpoints have been modified.
+    static bool can_copy_chunk(const checkpoint_chunk& chunk, xcom_version version)
+    {
+        if (chunk.data.empty() || chunk.dirty || chunk.data.source->version != version) {
+            return false;
+        }
+        bool checkpoints_clean = std::all_of(chunk.checkpoints.begin(), chunk.checkpoints.end(),
+            [version](const checkpoint& chk) {
+                return !chk.dirty && can_copy_properties(chk, version);
+            });
+        return checkpoints_clean && chunk_matches_original(chunk, version);
+    }
+
+    // Write a chunk, copying it if can_copy_chunk() said it could be.
+    static void write_checkpoint_chunk(xcom_io & w, const checkpoint_chunk& chunk, xcom_version version,
+        bool copy, checkpoint_layout *layout)
+    {
+        if (copy) {
+            w.write_raw(chunk.data.data(), static_cast<int32_t>(chunk.data.length));
+            return;
+        }
+
+        write_chunk_prefix(w, chunk);
+        write_checkpoint_table(w, chunk.checkpoints, version, layout);
+        write_chunk_suffix(w, chunk, version);
+    }
+
     static void write_checkpoint_chunks(xcom_io &w, const checkpoint_chunk_table& chunks, xcom_version version)
     {
         for (const checkpoint_chunk& chunk : chunks) {
-            write_checkpoint_chunk(w, chunk, version);
+            write_checkpoint_chunk(w, chunk, version, can_copy_chunk(chunk, version), nullptr);
+        }
+    }
+
+    // As write_checkpoint_chunks(), but encoding the checkpoints on several
+    // threads. The exact size of each checkpoint is worked out first, so the
+    // rest of the chunk data can be laid out around them, and each thread
+    // then writes whole checkpoints into their own part of the buffer.
+    static void write_checkpoint_chunks_parallel(xcom_io &w, const checkpoint_chunk_table& chunks,
+        xcom_version version, unsigned threads)
+    {
+        checkpoint_layout layout;
+        std::vector<bool> copy(chunks.size());
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            copy[c] = can_copy_chunk(chunks[c], version);
+            if (!copy[c]) {
+                for (const checkpoint& chk : chunks[c].checkpoints) {
+                    layout.slots.push_back({ &chk, 0, 0 });
+                }
+            }
+        }
+
+        util::parallel_for(layout.slots.size(), threads, [&layout, version](size_t i) {
+            layout.slots[i].size = checkpoint_size(*layout.slots[i].chk, version);
+        });
+
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            write_checkpoint_chunk(w, chunks[c], version, copy[c], &layout);
         }
+
+        // Everything else is in place and the buffer won't grow again.
+        std::ptrdiff_t end = w.offset();
+        w.seek(xcom_io::seek_kind::start, 0);
+        unsigned char *base = w.pointer();
+        w.seek(xcom_io::seek_kind::start, end);
+
+        util::parallel_for(layout.slots.size(), threads, [&layout, base, version](size_t i) {
+            const checkpoint_slot &slot = layout.slots[i];
+            xcom_io slot_writer{ base + slot.offset, slot.size };
+            write_checkpoint(slot_writer, *slot.chk, version);
+            if (static_cast<size_t>(slot_writer.offset()) != slot.size) {
+                throw xcom::error::general_exception("checkpoint " + slot.chk->name +
+                    " is smaller than its computed size");
+            }
+        });
     }
 
-    static char lzo_work_buffer[LZO1X_1_MEM_COMPRESS];
+    // LZO needs scratch memory to compress. Each thread gets its own so
+    // saves can be written concurrently.
+    static thread_local char lzo_work_buffer[LZO1X_1_MEM_COMPRESS];
 
     unsigned long compress_one_chunk(xcom_version version, const unsigned char *chunk_start, unsigned long chunk_size, unsigned char *output_start, unsigned long output_size)
     {
@@ -360,11 +587,12 @@ namespace xcom
             case xcom_version::enemy_unknown:
             case xcom_version::enemy_within:
             {
-                unsigned long bytes_compressed = output_size;
-                std::unique_ptr<char[]> wrkMem = std::make_unique<char[]>(LZO1X_1_MEM_COMPRESS);
+                static const int lzo_init_result = lzo_init();
+                if (lzo_init_result != LZO_E_OK) {
+                    throw xcom::error::general_exception("failed to initialize lzo");
+                }
 
-                lzo_init();
-                lzo_uint out_compressed_size = bytes_compressed;
+                lzo_uint out_compressed_size = output_size;
                 if (lzo1x_1_compress(chunk_start, chunk_size,
                     output_start, &out_compressed_size, lzo_work_buffer) != LZO_E_OK) {
                     throw xcom::error::general_exception("failed to compress chunk");
@@ -393,66 +621,174 @@ namespace xcom
         }
     }
 
-    buffer<unsigned char> compress(xcom_io &w, xcom_version version)
+    // The "flags" (?) value is always 20000, even for trailing chunks
+    static const int chunk_flags = 0x20000;
+
+    // Write the 24 byte header of a compressed chunk to output_ptr.
+    static void write_chunk_header(unsigned char *output_ptr, unsigned long compressed_size, int uncompressed_size)
+    {
+        // Write the magic number
+        le_store<int32_t>(output_ptr, UPK_Magic);
+        output_ptr += 4;
+        // Write the "flags" (?)
+        le_store<int32_t>(output_ptr, chunk_flags);
+        output_ptr += 4;
+        // Write the compressed size
+        le_store<int32_t>(output_ptr, static_cast<int32_t>(compressed_size));
+        output_ptr += 4;
+        // Write the uncompressed size of this chunk
+        le_store<int32_t>(output_ptr, uncompressed_size);
+        output_ptr += 4;
+        // Write the compressed size
+        le_store<int32_t>(output_ptr, static_cast<int32_t>(compressed_size));
+        output_ptr += 4;
+        // Write the uncompressed size
+        le_store<int32_t>(output_ptr, uncompressed_size);
+    }
+
+    // If the original save has a compressed chunk holding exactly this data
+    // at this position, return it so it can be copied instead of compressed.
+    static const compressed_chunk* find_unchanged_chunk(const save_source *original, xcom_version version,
+        size_t index, size_t offset, const unsigned char *data, int size)
+    {
+        if (original == nullptr || original->version != version || index >= original->chunks.size()) {
+            return nullptr;
+        }
+
+        // The sizes come from the original file: only reuse a chunk that
+        // lies wholly within it.
+        const compressed_chunk &chunk = original->chunks[index];
+        if (chunk.compressed_size < 0 || chunk.compressed_offset > original->compressed.length ||
+                original->compressed.length - chunk.compressed_offset < 24 + static_cast<size_t>(chunk.compressed_size)) {
+            return nullptr;
+        }
+        if (chunk.uncompressed_offset != offset || chunk.uncompressed_size != size ||
+                memcmp(original->data.buf.get() + offset, data, size) != 0) {
+            return nullptr;
+        }
+        return &chunk;
+    }
+
+    buffer<unsigned char> compress(xcom_io &w, xcom_version version, const save_source *original)
     {
         int32_t total_in_size = static_cast<int32_t>(w.offset());
-        // Allocate a new buffer to hold the compressed data. Just allocate as
-        // much as the uncompressed buffer since we don't know how big it will
-        // be, but it'll presumably be smaller.
-        buffer<unsigned char> b;
-        b.buf = std::make_unique<unsigned char[]>(total_in_size);
 
         // Compress the data in 128k chunks
         static const int max_chunk_size = 0x20000;
 
-        // The "flags" (?) value is always 20000, even for trailing chunks
-        static const int chunk_flags = 0x20000;
         w.seek(xcom_io::seek_kind::start, 0);
-        const unsigned char *chunk_start = w.pointer();
-        // Reserve 1024 bytes at the start of the compressed buffer for the header.
-        unsigned char *output_ptr = b.buf.get() + 1024;
-        int bytes_left = total_in_size;
-        int total_out_size = 1024;
+        const unsigned char *data = w.pointer();
 
-        do
+        // Decide how each chunk is written first, so we know how big the
+        // result is: copied from the original save if its data is unchanged,
+        // otherwise compressed here.
+        struct output_chunk
         {
-            int chunk_size = (bytes_left < max_chunk_size) ? bytes_left : max_chunk_size;
-
-            // Compress the next chunk, reserving 24 bytes from the current output position for the chunk header.
-            unsigned long bytes_compressed = compress_one_chunk(version, chunk_start, chunk_size, output_ptr + 24, bytes_left);
-
-            // Write the magic number
-            *reinterpret_cast<int*>(output_ptr) = UPK_Magic;
-            output_ptr += 4;
-            // Write the "flags" (?)
-            *reinterpret_cast<int*>(output_ptr) = chunk_flags;
-            output_ptr += 4;
-            // Write the compressed size
-            *reinterpret_cast<int*>(output_ptr) = bytes_compressed;
-            output_ptr += 4;
-            // Write the uncompressed size of this chunk
-            *reinterpret_cast<int*>(output_ptr) = chunk_size;
-            output_ptr += 4;
-            // Write the compressed size
-            *reinterpret_cast<int*>(output_ptr) = bytes_compressed;
-            output_ptr += 4;
-            // Write the uncompressed size
-            *reinterpret_cast<int*>(output_ptr) = chunk_size;
-            output_ptr += 4;
-
-            // Skip over the compressed chunk we wrote
-            output_ptr += bytes_compressed;
-
-            bytes_left -= chunk_size;
-            chunk_start += chunk_size;
-            total_out_size += bytes_compressed + 24;
-        } while (bytes_left > 0);
+            int uncompressed_size;
+            const compressed_chunk *unchanged;
+            buffer<unsigned char> compressed;
+        };
+        std::vector<output_chunk> chunks;
+        size_t total_out_size = 1024;
+
+        for (int offset = 0; offset < total_in_size || offset == 0; offset += max_chunk_size) {
+            int chunk_size = std::min(total_in_size - offset, max_chunk_size);
+            output_chunk out{ chunk_size, find_unchanged_chunk(original, version, chunks.size(), offset,
+                data + offset, chunk_size), {} };
+
+            if (out.unchanged != nullptr) {
+                total_out_size += 24 + out.unchanged->compressed_size;
+            }
+            else {
+                // Leave room for incompressible data: LZO can expand its
+                // input by up to 1/16th plus a little.
+                unsigned long bound = chunk_size + chunk_size / 16 + 64 + 3;
+                out.compressed.buf = std::make_unique<unsigned char[]>(bound);
+                out.compressed.length = compress_one_chunk(version, data + offset, chunk_size,
+                    out.compressed.buf.get(), bound);
+                total_out_size += 24 + out.compressed.length;
+            }
+            chunks.push_back(std::move(out));
+        }
 
+        buffer<unsigned char> b;
+        b.buf = std::make_unique<unsigned char[]>(total_out_size);
         b.length = total_out_size;
+
+        // Reserve 1024 bytes at the start of the compressed buffer for the header.
+        unsigned char *output_ptr = b.buf.get() + 1024;
+        for (const output_chunk &chunk : chunks) {
+            if (chunk.unchanged != nullptr) {
+                // Same data as the original save: copy its chunk header and
+                // compressed data.
+                memcpy(output_ptr, original->compressed.buf.get() + chunk.unchanged->compressed_offset,
+                    24 + chunk.unchanged->compressed_size);
+                output_ptr += 24 + chunk.unchanged->compressed_size;
+            }
+            else {
+                write_chunk_header(output_ptr, static_cast<unsigned long>(chunk.compressed.length),
+                    chunk.uncompressed_size);
+                memcpy(output_ptr + 24, chunk.compressed.buf.get(), chunk.compressed.length);
+                output_ptr += 24 + chunk.compressed.length;
+            }
+        }
+
         return b;
     }
 
-    buffer<unsigned char> write_xcom_save(const saved_game &save)
+    buffer<unsigned char> recompress_save(const header &hdr, const save_source &src,
+        const std::vector<bool> &dirty_chunks)
+    {
+        // Compress the dirty chunks first so we know how big the result is.
+        std::vector<buffer<unsigned char>> recompressed(src.chunks.size());
+        size_t total_out_size = 1024;
+
+        for (size_t i = 0; i < src.chunks.size(); ++i) {
+            const compressed_chunk &chunk = src.chunks[i];
+            if (dirty_chunks[i]) {
+                // Leave room for incompressible data: LZO can expand its
+                // input by up to 1/16th plus a little.
+                unsigned long bound = chunk.uncompressed_size + chunk.uncompressed_size / 16 + 64 + 3;
+                buffer<unsigned char> &out = recompressed[i];
+                out.buf = std::make_unique<unsigned char[]>(bound);
+                out.length = compress_one_chunk(src.version, src.data.buf.get() + chunk.uncompressed_offset,
+                    chunk.uncompressed_size, out.buf.get(), bound);
+                total_out_size += 24 + out.length;
+            }
+            else {
+                total_out_size += 24 + chunk.compressed_size;
+            }
+        }
+
+        buffer<unsigned char> b;
+        b.buf = std::make_unique<unsigned char[]>(total_out_size);
+        b.length = total_out_size;
+
+        // Start from the original header so any bytes we don't know the
+        // meaning of are preserved. write_header() fills in the rest.
+        memcpy(b.buf.get(), src.compressed.buf.get(), 1024);
+        unsigned char *output_ptr = b.buf.get() + 1024;
+
+        for (size_t i = 0; i < src.chunks.size(); ++i) {
+            const compressed_chunk &chunk = src.chunks[i];
+            if (dirty_chunks[i]) {
+                const buffer<unsigned char> &out = recompressed[i];
+                write_chunk_header(output_ptr, static_cast<unsigned long>(out.length), chunk.uncompressed_size);
+                memcpy(output_ptr + 24, out.buf.get(), out.length);
+                output_ptr += 24 + out.length;
+            }
+            else {
+                memcpy(output_ptr, src.compressed.buf.get() + chunk.compressed_offset, 24 + chunk.compressed_size);
+                output_ptr += 24 + chunk.compressed_size;
+            }
+        }
+
+        xcom_io compressed{ std::move(b) };
+        write_header(compressed, hdr);
+        return compressed.release();
+    }
+
+    buffer<unsigned char> write_xcom_save(const saved_game &save, const write_options &options)
     {
         xcom_io w{};
 
@@ -467,15 +803,20 @@ namespace xcom
         {
             write_actor_table(w, save.actors);
         }
-        write_checkpoint_chunks(w, save.checkpoints, save.hdr.version);
-        xcom_io compressed{ compress(w, save.hdr.version) };
+        if (options.threads == 1) {
+            write_checkpoint_chunks(w, save.checkpoints, save.hdr.version);
+        }
+        else {
+            write_checkpoint_chunks_parallel(w, save.checkpoints, save.hdr.version, options.threads);
+        }
+        xcom_io compressed{ compress(w, save.hdr.version, save.source.get()) };
         write_header(compressed, save.hdr);
         return compressed.release();
     }
 
-    void write_xcom_save(const saved_game &save, const std::string& outfile)
+    void write_xcom_save(const saved_game &save, const std::string& outfile, const write_options &options)
     {
-        buffer<unsigned char> b = write_xcom_save(save);
+        buffer<unsigned char> b = write_xcom_save(save, options);
         FILE *fp = fopen(outfile.c_str(), "wb");
         fwrite(b.buf.get(), 1, b.length, fp);
         fclose(fp);